@@ -94,6 +94,10 @@ struct background {
 	char *image;
 	int type;
 	uint32_t color;
+
+	/* The decoded image, and the size it was decoded for */
+	cairo_surface_t *image_surface;
+	int image_width, image_height;
 };
 
 struct output {
@@ -683,6 +687,43 @@ enum {
 	BACKGROUND_TILE
 };
 
+/* Returns the background image decoded for a width x height buffer, and
+ * keeps it for the next redraw at the same size. */
+static cairo_surface_t *
+background_get_image(struct background *background, int width, int height)
+{
+	const char *filename;
+
+	if (background->image)
+		filename = background->image;
+	else if (background->color == 0)
+		filename = DATADIR "/weston/pattern.png";
+	else
+		return NULL;
+
+	/* Tiles are drawn at the size of the image */
+	if (background->type != BACKGROUND_SCALE &&
+	    background->type != BACKGROUND_SCALE_CROP)
+		width = height = 0;
+
+	if (background->image_surface &&
+	    background->image_width == width &&
+	    background->image_height == height)
+		return cairo_surface_reference(background->image_surface);
+
+	if (background->image_surface)
+		cairo_surface_destroy(background->image_surface);
+
+	background->image_surface =
+		load_cairo_surface_scaled(filename, width, height);
+	background->image_width = width;
+	background->image_height = height;
+	if (background->image_surface == NULL)
+		return NULL;
+
+	return cairo_surface_reference(background->image_surface);
+}
+
 static void
 background_draw(struct widget *widget, void *data)
 {
@@ -695,6 +736,7 @@ background_draw(struct widget *widget, void *data)
 	double sx, sy, s;
 	double tx, ty;
 	struct rectangle allocation;
+	uint32_t scale;
 
 	surface = window_get_surface(background->window);
 
@@ -705,12 +747,14 @@ background_draw(struct widget *widget, void *data)
 
 	widget_get_allocation(widget, &allocation);
 	image = NULL;
-	if (background->image)
-		image = load_cairo_surface(background->image);
-	else if (background->color == 0)
-		image = load_cairo_surface(DATADIR "/weston/pattern.png");
+	if (background->type != -1) {
+		scale = window_get_buffer_scale(background->window);
+		image = background_get_image(background,
+					     allocation.width * scale,
+					     allocation.height * scale);
+	}
 
-	if (image && background->type != -1) {
+	if (image) {
 		im_w = cairo_image_surface_get_width(image);
 		im_h = cairo_image_surface_get_height(image);
 		sx = im_w / allocation.width;
@@ -1030,6 +1074,8 @@ background_destroy(struct background *background)
 	widget_destroy(background->widget);
 	window_destroy(background->window);
 
+	if (background->image_surface)
+		cairo_surface_destroy(background->image_surface);
 	free(background->image);
 	free(background);
 }
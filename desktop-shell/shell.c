@@ -625,6 +625,9 @@ shell_configuration(struct desktop_shell *shell)
 	weston_config_section_get_uint(section, "num-workspaces",
 				       &shell->workspaces.num,
 				       DEFAULT_NUM_WORKSPACES);
+	weston_config_section_get_int(section, "occluded-frame-interval",
+				      &shell->compositor->occluded_frame_interval,
+				      0);
 }
 
 struct weston_output *
@@ -4370,6 +4373,11 @@ desktop_shell_desktop_ready(struct wl_client *client,
 {
 	struct desktop_shell *shell = wl_resource_get_user_data(resource);
 
+	if (!shell->child.ready) {
+		weston_log_startup("desktop ready");
+		shell->child.ready = true;
+	}
+
 	shell_fade_startup(shell);
 }
 
@@ -6540,6 +6548,8 @@ module_init(struct weston_compositor *ec,
 	weston_layer_init(&shell->fullscreen_layer, &ec->cursor_layer.link);
 	weston_layer_init(&shell->panel_layer, &shell->fullscreen_layer.link);
 	weston_layer_init(&shell->background_layer, &shell->panel_layer.link);
+	shell->panel_layer.is_static = 1;
+	shell->background_layer.is_static = 1;
 	weston_layer_init(&shell->lock_layer, NULL);
 	weston_layer_init(&shell->input_panel_layer, NULL);
 
@@ -6599,7 +6609,6 @@ module_init(struct weston_compositor *ec,
 	setup_output_destroy_handler(ec, shell);
 
 	loop = wl_display_get_event_loop(ec->wl_display);
-	wl_event_loop_add_idle(loop, launch_desktop_shell_process, shell);
 
 	shell->screensaver.timer =
 		wl_event_loop_add_timer(loop, screensaver_timeout, shell);
@@ -6617,5 +6626,10 @@ module_init(struct weston_compositor *ec,
 
 	clock_gettime(CLOCK_MONOTONIC, &shell->startup_time);
 
+	/* Start the client now rather than once the compositor runs, so
+	 * that it starts up while the remaining modules load. It connects
+	 * over a socket pair, and its requests wait for the event loop. */
+	launch_desktop_shell_process(shell);
+
 	return 0;
 }
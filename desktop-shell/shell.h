@@ -141,6 +141,7 @@ struct desktop_shell {
 
 		unsigned deathcount;
 		uint32_t deathstamp;
+		bool ready;
 	} child;
 
 	bool locked;
@@ -47,14 +47,88 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
+#ifdef __GNUC__
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+#else
+typedef struct { uint32_t v[4]; } v4su;
+#endif
+
+/* Blurs the n pixels of a row or column, step pixels apart, from line,
+ * with the pixels unpacked to one lane per channel. Pixels from copy_start
+ * up to copy_end are copied instead. */
+static void
+blur_line(uint32_t *dst, int step, const v4su *line, int n,
+	  int copy_start, int copy_end, const uint32_t *kernel, int size,
+	  uint32_t a)
+{
+	int half = size / 2;
+	int j, k, k0, k1;
+	v4su sum;
+
+	for (j = 0; j < n; j++) {
+		if (copy_start <= j && j < copy_end) {
+			j = copy_end - 1;
+			continue;
+		}
+
+		/* The taps that fall inside the line */
+		k0 = j < half ? half - j : 0;
+		k1 = n - j + half < size ? n - j + half : size;
+
+#ifdef __GNUC__
+		sum = (v4su) { 0, 0, 0, 0 };
+		for (k = k0; k < k1; k++)
+			sum += line[j - half + k] * kernel[k];
+
+		dst[j * step] = (sum[0] / a << 24) | (sum[1] / a << 16) |
+				(sum[2] / a << 8) | sum[3] / a;
+#else
+		memset(&sum, 0, sizeof sum);
+		for (k = k0; k < k1; k++) {
+			sum.v[0] += line[j - half + k].v[0] * kernel[k];
+			sum.v[1] += line[j - half + k].v[1] * kernel[k];
+			sum.v[2] += line[j - half + k].v[2] * kernel[k];
+			sum.v[3] += line[j - half + k].v[3] * kernel[k];
+		}
+
+		dst[j * step] = (sum.v[0] / a << 24) | (sum.v[1] / a << 16) |
+				(sum.v[2] / a << 8) | sum.v[3] / a;
+#endif
+	}
+}
+
+static void
+unpack_line(v4su *line, const uint32_t *src, int step, int n)
+{
+	uint32_t p;
+	int j;
+
+	for (j = 0; j < n; j++) {
+		p = src[j * step];
+#ifdef __GNUC__
+		line[j] = (v4su) { p >> 24, (p >> 16) & 0xff,
+				   (p >> 8) & 0xff, p & 0xff };
+#else
+		line[j].v[0] = p >> 24;
+		line[j].v[1] = (p >> 16) & 0xff;
+		line[j].v[2] = (p >> 8) & 0xff;
+		line[j].v[3] = p & 0xff;
+#endif
+	}
+}
+
+/* A separable gaussian blur of the pixels within margin of the edges. The
+ * rows and columns are unpacked to a channel per vector lane first, so
+ * each kernel tap is a single multiply-add. */
 static int
 blur_surface(cairo_surface_t *surface, int margin)
 {
-	int32_t width, height, stride, x, y, z, w;
+	int32_t width, height, stride;
 	uint8_t *src, *dst;
-	uint32_t *s, *d, a, p;
-	int i, j, k, size, half;
+	uint32_t *s, *d, a;
+	int i, j, size, half;
 	uint32_t kernel[71];
+	v4su *line;
 	double f;
 
 	size = ARRAY_LENGTH(kernel);
@@ -67,6 +141,12 @@ blur_surface(cairo_surface_t *surface, int margin)
 	if (dst == NULL)
 		return -1;
 
+	line = malloc((width > height ? width : height) * sizeof *line);
+	if (line == NULL) {
+		free(dst);
+		return -1;
+	}
+
 	half = size / 2;
 	a = 0;
 	for (i = 0; i < size; i++) {
@@ -75,61 +155,28 @@ blur_surface(cairo_surface_t *surface, int margin)
 		a += kernel[i];
 	}
 
+	cairo_surface_flush(surface);
+
 	for (i = 0; i < height; i++) {
 		s = (uint32_t *) (src + i * stride);
 		d = (uint32_t *) (dst + i * stride);
-		for (j = 0; j < width; j++) {
-			if (margin < j && j < width - margin) {
-				d[j] = s[j];
-				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (j - half + k < 0 || j - half + k >= width)
-					continue;
-				p = s[j - half + k];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
-		}
+		memcpy(d, s, width * 4);
+		unpack_line(line, s, 1, width);
+		blur_line(d, 1, line, width, margin + 1, width - margin,
+			  kernel, size, a);
 	}
 
-	for (i = 0; i < height; i++) {
-		s = (uint32_t *) (dst + i * stride);
-		d = (uint32_t *) (src + i * stride);
-		for (j = 0; j < width; j++) {
-			if (margin <= i && i < height - margin) {
-				d[j] = s[j];
-				continue;
-			}
-
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (i - half + k < 0 || i - half + k >= height)
-					continue;
-				s = (uint32_t *) (dst + (i - half + k) * stride);
-				p = s[j];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
-			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
-		}
+	for (j = 0; j < width; j++) {
+		s = (uint32_t *) dst + j;
+		d = (uint32_t *) src + j;
+		unpack_line(line, s, stride / 4, height);
+		for (i = 0; i < height; i++)
+			d[i * stride / 4] = s[i * stride / 4];
+		blur_line(d, stride / 4, line, height, margin, height - margin,
+			  kernel, size, a);
 	}
 
+	free(line);
 	free(dst);
 	cairo_surface_mark_dirty(surface);
 
@@ -300,14 +347,23 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius)
 	cairo_close_path(cr);
 }
 
+static const cairo_user_data_key_t image_key;
+
+static void
+destroy_image(void *data)
+{
+	pixman_image_unref(data);
+}
+
 cairo_surface_t *
-load_cairo_surface(const char *filename)
+load_cairo_surface_scaled(const char *filename, int width, int height)
 {
 	pixman_image_t *image;
-	int width, height, stride;
+	cairo_surface_t *surface;
 	void *data;
+	int stride;
 
-	image = load_image(filename);
+	image = load_image_scaled(filename, width, height);
 	if (image == NULL) {
 		return NULL;
 	}
@@ -317,8 +373,24 @@ load_cairo_surface(const char *filename)
 	height = pixman_image_get_height(image);
 	stride = pixman_image_get_stride(image);
 
-	return cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32,
-						   width, height, stride);
+	/* The surface keeps the image, and its pixels, alive */
+	surface = cairo_image_surface_create_for_data(data,
+						      CAIRO_FORMAT_ARGB32,
+						      width, height, stride);
+	if (cairo_surface_set_user_data(surface, &image_key, image,
+					destroy_image) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		pixman_image_unref(image);
+		return NULL;
+	}
+
+	return surface;
+}
+
+cairo_surface_t *
+load_cairo_surface(const char *filename)
+{
+	return load_cairo_surface_scaled(filename, 0, 0);
 }
 
 void
@@ -337,6 +409,80 @@ theme_set_background_source(struct theme *t, cairo_t *cr, uint32_t flags)
 	}
 }
 
+/* Blurred shadow tiles, shared by the themes of a process while any of
+ * them holds a reference. An entry goes away with its surface. */
+struct shadow_tile {
+	int size, radius;
+	cairo_surface_t *surface;
+	struct shadow_tile *next;
+};
+
+static struct shadow_tile *shadow_tiles;
+static const cairo_user_data_key_t shadow_tile_key;
+
+static void
+shadow_tile_destroy(void *data)
+{
+	struct shadow_tile *tile = data, **p;
+
+	for (p = &shadow_tiles; *p; p = &(*p)->next) {
+		if (*p == tile) {
+			*p = tile->next;
+			break;
+		}
+	}
+
+	free(tile);
+}
+
+/* Returns a reference to the shadow of a rounded rectangle of half the
+ * tile size and the given corner radius, centered in a size x size tile,
+ * for tile_mask(). */
+static cairo_surface_t *
+shadow_tile_get(int size, int radius)
+{
+	struct shadow_tile *tile;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	for (tile = shadow_tiles; tile; tile = tile->next)
+		if (tile->size == size && tile->radius == radius)
+			return cairo_surface_reference(tile->surface);
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+	cr = cairo_create(surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+	rounded_rect(cr, size / 4, size / 4, size * 3 / 4, size * 3 / 4,
+		     radius);
+	cairo_fill(cr);
+	if (cairo_status(cr) != CAIRO_STATUS_SUCCESS) {
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	cairo_destroy(cr);
+
+	tile = malloc(sizeof *tile);
+	if (tile == NULL ||
+	    blur_surface(surface, size / 2) == -1 ||
+	    cairo_surface_set_user_data(surface, &shadow_tile_key, tile,
+					shadow_tile_destroy) !=
+	    CAIRO_STATUS_SUCCESS) {
+		free(tile);
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	tile->size = size;
+	tile->radius = radius;
+	tile->surface = surface;
+	tile->next = shadow_tiles;
+	shadow_tiles = tile;
+
+	return surface;
+}
+
 struct theme *
 theme_create(void)
 {
@@ -351,16 +497,8 @@ theme_create(void)
 	t->width = 6;
 	t->titlebar_height = 27;
 	t->frame_radius = 3;
-	t->shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
-	cr = cairo_create(t->shadow);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_set_source_rgba(cr, 0, 0, 0, 1);
-	rounded_rect(cr, 32, 32, 96, 96, t->frame_radius);
-	cairo_fill(cr);
-	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
-		goto err_shadow;
-	cairo_destroy(cr);
-	if (blur_surface(t->shadow, 64) == -1)
+	t->shadow = shadow_tile_get(128, t->frame_radius);
+	if (t->shadow == NULL)
 		goto err_shadow;
 
 	t->active_frame =
@@ -396,8 +534,8 @@ theme_create(void)
 	cairo_surface_destroy(t->inactive_frame);
  err_active_frame:
 	cairo_surface_destroy(t->active_frame);
- err_shadow:
 	cairo_surface_destroy(t->shadow);
+ err_shadow:
 	free(t);
 	return NULL;
 }
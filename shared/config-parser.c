@@ -28,36 +28,87 @@
 #include <assert.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include <wayland-util.h>
 #include "config-parser.h"
+#include "zalloc.h"
 
 #define container_of(ptr, type, member) ({				\
 	const __typeof__( ((type *)0)->member ) *__mptr = (ptr);	\
 	(type *)( (char *)__mptr - offsetof(type,member) );})
 
+/* Sections are hashed by name and entries by section and key, into
+ * chains kept in file order, so that the first of several sections or
+ * keys of the same name is found first. */
+#define CONFIG_SECTION_BUCKETS	256
+#define CONFIG_ENTRY_BUCKETS	1024
+
 struct weston_config_entry {
 	char *key;
 	char *value;
 	struct wl_list link;
+	struct weston_config_section *section;
+	uint32_t hash;
+	struct weston_config_entry *hash_next;
 };
 
 struct weston_config_section {
 	char *name;
 	struct wl_list entry_list;
 	struct wl_list link;
+	struct weston_config *config;
+	uint32_t index;
+	uint32_t hash;
+	struct weston_config_section *hash_next;
 };
 
 struct weston_config {
 	struct wl_list section_list;
 	char path[PATH_MAX];
+
+	uint32_t section_count;
+	struct weston_config_section *section_hash[CONFIG_SECTION_BUCKETS];
+	struct weston_config_section *section_tail[CONFIG_SECTION_BUCKETS];
+	struct weston_config_entry *entry_hash[CONFIG_ENTRY_BUCKETS];
+	struct weston_config_entry *entry_tail[CONFIG_ENTRY_BUCKETS];
+
+	/* Set when loaded from the parse cache: the sections and entries
+	 * are allocated as two arrays, and their strings point into the
+	 * mapped cache file. */
+	void *map;
+	size_t map_size;
+	struct weston_config_section *sections;
+	struct weston_config_entry *entries;
 };
 
+/* FNV-1a */
+static uint32_t
+config_hash(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s) {
+		hash ^= (unsigned char) *s++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static uint32_t
+config_entry_hash(const struct weston_config_section *section,
+		  const char *key)
+{
+	return config_hash(key) ^ (section->index * 2654435761u);
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -120,11 +171,16 @@ config_section_get_entry(struct weston_config_section *section,
 			 const char *key)
 {
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (section == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
-		if (strcmp(e->key, key) == 0)
+
+	hash = config_entry_hash(section, key);
+	e = section->config->entry_hash[hash % CONFIG_ENTRY_BUCKETS];
+	for (; e; e = e->hash_next)
+		if (e->hash == hash && e->section == section &&
+		    strcmp(e->key, key) == 0)
 			return e;
 
 	return NULL;
@@ -137,11 +193,15 @@ weston_config_get_section(struct weston_config *config, const char *section,
 {
 	struct weston_config_section *s;
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
+
+	hash = config_hash(section);
+	s = config->section_hash[hash % CONFIG_SECTION_BUCKETS];
+	for (; s; s = s->hash_next) {
+		if (s->hash != hash || strcmp(s->name, section) != 0)
 			continue;
 		if (key == NULL)
 			return s;
@@ -294,6 +354,49 @@ weston_config_get_libexec_dir(void)
 	return LIBEXECDIR;
 }
 
+/* Links a section, with its name set, at the end of the config. */
+static void
+config_link_section(struct weston_config *config,
+		    struct weston_config_section *section)
+{
+	uint32_t bucket;
+
+	section->config = config;
+	section->index = config->section_count++;
+	section->hash = config_hash(section->name);
+	section->hash_next = NULL;
+	wl_list_init(&section->entry_list);
+	wl_list_insert(config->section_list.prev, &section->link);
+
+	bucket = section->hash % CONFIG_SECTION_BUCKETS;
+	if (config->section_tail[bucket])
+		config->section_tail[bucket]->hash_next = section;
+	else
+		config->section_hash[bucket] = section;
+	config->section_tail[bucket] = section;
+}
+
+/* Links an entry, with its key and value set, at the end of the section. */
+static void
+section_link_entry(struct weston_config_section *section,
+		   struct weston_config_entry *entry)
+{
+	struct weston_config *config = section->config;
+	uint32_t bucket;
+
+	entry->section = section;
+	entry->hash = config_entry_hash(section, entry->key);
+	entry->hash_next = NULL;
+	wl_list_insert(section->entry_list.prev, &entry->link);
+
+	bucket = entry->hash % CONFIG_ENTRY_BUCKETS;
+	if (config->entry_tail[bucket])
+		config->entry_tail[bucket]->hash_next = entry;
+	else
+		config->entry_hash[bucket] = entry;
+	config->entry_tail[bucket] = entry;
+}
+
 static struct weston_config_section *
 config_add_section(struct weston_config *config, const char *name)
 {
@@ -301,8 +404,7 @@ config_add_section(struct weston_config *config, const char *name)
 
 	section = malloc(sizeof *section);
 	section->name = strdup(name);
-	wl_list_init(&section->entry_list);
-	wl_list_insert(config->section_list.prev, &section->link);
+	config_link_section(config, section);
 
 	return section;
 }
@@ -316,11 +418,278 @@ section_add_entry(struct weston_config_section *section,
 	entry = malloc(sizeof *entry);
 	entry->key = strdup(key);
 	entry->value = strdup(value);
-	wl_list_insert(section->entry_list.prev, &entry->link);
+	section_link_entry(section, entry);
 
 	return entry;
 }
 
+/*
+ * The parse cache is the parsed config written out by the first process
+ * to parse it, as a header, the sections, the entries and the strings,
+ * for the next ones to map instead of parsing the file again. It lives in
+ * $XDG_RUNTIME_DIR, named after a hash of the config file path, and is
+ * only used while the file has the device, inode, size and modification
+ * time recorded in it.
+ */
+
+#define CONFIG_CACHE_MAGIC	0x47464357	/* "WCFG" */
+#define CONFIG_CACHE_VERSION	1
+
+struct config_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t section_count;
+	uint32_t entry_count;
+	uint32_t string_size;
+	uint32_t path;		/* string offset of the config file path */
+};
+
+struct config_cache_section {
+	uint32_t name;
+	uint32_t entry_count;
+};
+
+struct config_cache_entry {
+	uint32_t key;
+	uint32_t value;
+};
+
+static int
+config_cache_path(const struct weston_config *config,
+		  char *path, size_t size)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if (dir == NULL || getenv("WESTON_CONFIG_NO_CACHE"))
+		return -1;
+
+	if (snprintf(path, size, "%s/weston-config-%08x.cache", dir,
+		     config_hash(config->path)) >= (int) size)
+		return -1;
+
+	return 0;
+}
+
+static int
+config_cache_matches(const struct config_cache_header *header,
+		     const struct stat *st)
+{
+	return header->magic == CONFIG_CACHE_MAGIC &&
+	       header->version == CONFIG_CACHE_VERSION &&
+	       header->dev == (uint64_t) st->st_dev &&
+	       header->ino == (uint64_t) st->st_ino &&
+	       header->size == (uint64_t) st->st_size &&
+	       header->mtime_sec == (int64_t) st->st_mtim.tv_sec &&
+	       header->mtime_nsec == (int64_t) st->st_mtim.tv_nsec;
+}
+
+/* Maps the cache of the config file open as fd, and builds the config
+ * from it, if it is there and up to date. */
+static int
+config_load_cache(struct weston_config *config, int fd)
+{
+	const struct config_cache_header *header;
+	const struct config_cache_section *cs;
+	const struct config_cache_entry *ce;
+	const char *strings;
+	char path[PATH_MAX];
+	struct stat st, cache_st;
+	size_t size;
+	uint32_t i, j, k;
+	void *map;
+	int cache_fd;
+
+	if (config_cache_path(config, path, sizeof path) < 0 ||
+	    fstat(fd, &st) < 0)
+		return -1;
+
+	cache_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (cache_fd < 0)
+		return -1;
+
+	if (fstat(cache_fd, &cache_st) < 0 ||
+	    cache_st.st_size < (off_t) sizeof *header) {
+		close(cache_fd);
+		return -1;
+	}
+
+	size = cache_st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+	close(cache_fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	/* Check that everything the header and the records point at is
+	 * inside the file, so a stale or broken cache is never trusted. */
+	header = map;
+	if (!config_cache_matches(header, &st) ||
+	    (uint64_t) header->section_count * sizeof *cs +
+	    (uint64_t) header->entry_count * sizeof *ce +
+	    header->string_size != size - sizeof *header)
+		goto err_unmap;
+
+	cs = (const struct config_cache_section *) (header + 1);
+	ce = (const struct config_cache_entry *) (cs + header->section_count);
+	strings = (const char *) (ce + header->entry_count);
+	if (header->string_size == 0 ||
+	    strings[header->string_size - 1] != '\0' ||
+	    header->path >= header->string_size ||
+	    strcmp(strings + header->path, config->path) != 0)
+		goto err_unmap;
+
+	for (i = 0, j = 0; i < header->section_count; i++) {
+		if (cs[i].name >= header->string_size ||
+		    cs[i].entry_count > header->entry_count - j)
+			goto err_unmap;
+		j += cs[i].entry_count;
+	}
+	for (i = 0; i < header->entry_count; i++)
+		if (ce[i].key >= header->string_size ||
+		    ce[i].value >= header->string_size)
+			goto err_unmap;
+
+	config->sections = calloc(header->section_count + 1,
+				  sizeof *config->sections);
+	config->entries = calloc(header->entry_count + 1,
+				 sizeof *config->entries);
+	if (config->sections == NULL || config->entries == NULL) {
+		free(config->sections);
+		free(config->entries);
+		goto err_unmap;
+	}
+
+	for (i = 0, k = 0; i < header->section_count; i++) {
+		config->sections[i].name = (char *) strings + cs[i].name;
+		config_link_section(config, &config->sections[i]);
+		for (j = 0; j < cs[i].entry_count; j++, k++) {
+			config->entries[k].key = (char *) strings + ce[k].key;
+			config->entries[k].value =
+				(char *) strings + ce[k].value;
+			section_link_entry(&config->sections[i],
+					   &config->entries[k]);
+		}
+	}
+
+	config->map = map;
+	config->map_size = size;
+
+	return 0;
+
+err_unmap:
+	munmap(map, size);
+	return -1;
+}
+
+static uint32_t
+config_cache_add_string(struct wl_array *strings, const char *s)
+{
+	uint32_t offset = strings->size;
+	size_t len = strlen(s) + 1;
+	char *p;
+
+	p = wl_array_add(strings, len);
+	if (p)
+		memcpy(p, s, len);
+
+	return offset;
+}
+
+/* Writes the cache for the config just parsed from the file open as fd,
+ * which had the attributes st before it was parsed. If the file changed
+ * while it was parsed, what was parsed may be neither version, and
+ * nothing is written. The cache goes to a temporary file first, so that
+ * no reader ever maps a partly written cache. */
+static void
+config_write_cache(struct weston_config *config, int fd,
+		   const struct stat *st)
+{
+	struct config_cache_header header;
+	struct config_cache_section *cs;
+	struct config_cache_entry *ce;
+	struct weston_config_section *s;
+	struct weston_config_entry *e;
+	struct wl_array sections, entries, strings;
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	struct stat parsed_st;
+	FILE *fp;
+	int tmp_fd, ok;
+
+	if (config_cache_path(config, path, sizeof path) < 0)
+		return;
+
+	memset(&header, 0, sizeof header);
+	header.magic = CONFIG_CACHE_MAGIC;
+	header.version = CONFIG_CACHE_VERSION;
+	header.dev = st->st_dev;
+	header.ino = st->st_ino;
+	header.size = st->st_size;
+	header.mtime_sec = st->st_mtim.tv_sec;
+	header.mtime_nsec = st->st_mtim.tv_nsec;
+
+	if (fstat(fd, &parsed_st) < 0 ||
+	    !config_cache_matches(&header, &parsed_st))
+		return;
+
+	wl_array_init(&sections);
+	wl_array_init(&entries);
+	wl_array_init(&strings);
+
+	header.path = config_cache_add_string(&strings, config->path);
+
+	wl_list_for_each(s, &config->section_list, link) {
+		cs = wl_array_add(&sections, sizeof *cs);
+		if (cs == NULL)
+			goto out;
+		cs->name = config_cache_add_string(&strings, s->name);
+		cs->entry_count = 0;
+		wl_list_for_each(e, &s->entry_list, link) {
+			ce = wl_array_add(&entries, sizeof *ce);
+			if (ce == NULL)
+				goto out;
+			ce->key = config_cache_add_string(&strings, e->key);
+			ce->value = config_cache_add_string(&strings,
+							    e->value);
+			cs->entry_count++;
+		}
+	}
+
+	header.section_count = sections.size / sizeof *cs;
+	header.entry_count = entries.size / sizeof *ce;
+	header.string_size = strings.size;
+
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	tmp_fd = mkstemp(tmp);
+	if (tmp_fd < 0)
+		goto out;
+
+	fp = fdopen(tmp_fd, "w");
+	if (fp == NULL) {
+		close(tmp_fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	/* The path is always there, the sections and entries may not be */
+	ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+	     (sections.size == 0 ||
+	      fwrite(sections.data, sections.size, 1, fp) == 1) &&
+	     (entries.size == 0 ||
+	      fwrite(entries.data, entries.size, 1, fp) == 1) &&
+	     fwrite(strings.data, strings.size, 1, fp) == 1;
+	if (fclose(fp) != 0 || !ok || rename(tmp, path) < 0)
+		unlink(tmp);
+
+out:
+	wl_array_release(&sections);
+	wl_array_release(&entries);
+	wl_array_release(&strings);
+}
+
 struct weston_config *
 weston_config_parse(const char *name)
 {
@@ -328,9 +697,10 @@ weston_config_parse(const char *name)
 	char line[512], *p;
 	struct weston_config *config;
 	struct weston_config_section *section = NULL;
-	int i, fd;
+	struct stat st;
+	int i, fd, cache;
 
-	config = malloc(sizeof *config);
+	config = zalloc(sizeof *config);
 	if (config == NULL)
 		return NULL;
 
@@ -342,8 +712,16 @@ weston_config_parse(const char *name)
 		return NULL;
 	}
 
+	if (config_load_cache(config, fd) == 0) {
+		close(fd);
+		return config;
+	}
+
+	cache = fstat(fd, &st) == 0;
+
 	fp = fdopen(fd, "r");
 	if (fp == NULL) {
+		close(fd);
 		free(config);
 		return NULL;
 	}
@@ -389,6 +767,8 @@ weston_config_parse(const char *name)
 		}
 	}
 
+	if (cache)
+		config_write_cache(config, fileno(fp), &st);
 	fclose(fp);
 
 	return config;
@@ -432,6 +812,14 @@ weston_config_destroy(struct weston_config *config)
 	if (config == NULL)
 		return;
 
+	if (config->map) {
+		free(config->sections);
+		free(config->entries);
+		munmap(config->map, config->map_size);
+		free(config);
+		return;
+	}
+
 	wl_list_for_each_safe(s, next_s, &config->section_list, link) {
 		wl_list_for_each_safe(e, next_e, &s->entry_list, link) {
 			free(e->key);
@@ -26,6 +26,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <wayland-util.h>
 #include <linux/input.h>
 
@@ -80,6 +81,36 @@ struct frame_touch {
 	struct frame_button *button;
 };
 
+/* The shadow that theme_render_frame() draws with tile_mask() reaches this
+ * far into the frame from its edges */
+#define FRAME_SHADOW_REACH (2 + 64)
+
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
+enum frame_strip {
+	FRAME_STRIP_TOP,
+	FRAME_STRIP_BOTTOM,
+	FRAME_STRIP_LEFT,
+	FRAME_STRIP_RIGHT,
+	FRAME_STRIP_COUNT
+};
+
+struct frame_rect {
+	int32_t x, y;
+	int32_t width, height;
+};
+
+/* The top strip holds the title bar and the top corners, the others the
+ * remaining edges and corners. Each is a device space surface created
+ * similar to the target. Everything between them is transparent. */
+struct frame_cache {
+	cairo_surface_t *strips[FRAME_STRIP_COUNT];
+	struct frame_rect rects[FRAME_STRIP_COUNT];
+	uint32_t flags;
+	cairo_matrix_t matrix;
+	int valid;
+};
+
 struct frame {
 	int32_t width, height;
 	char *title;
@@ -99,8 +130,27 @@ struct frame {
 	struct wl_list buttons;
 	struct wl_list pointers;
 	struct wl_list touches;
+
+	/* The decoration strips as theme_render_frame() last drew them, for
+	 * the inactive and the active state, and the frame size the last
+	 * repaint was done at */
+	struct frame_cache cache[2];
+	int32_t cache_width, cache_height;
 };
 
+static void
+frame_cache_clear(struct frame_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < FRAME_STRIP_COUNT; i++) {
+		if (cache->strips[i])
+			cairo_surface_destroy(cache->strips[i]);
+		cache->strips[i] = NULL;
+	}
+	cache->valid = 0;
+}
+
 static struct frame_button *
 frame_button_create(struct frame *frame, const char *icon,
 		    enum frame_status status_effect,
@@ -293,6 +343,8 @@ frame_destroy(struct frame *frame)
 	wl_list_for_each_safe(pointer, next_pointer, &frame->pointers, link)
 		frame_pointer_destroy(pointer);
 
+	frame_cache_clear(&frame->cache[0]);
+	frame_cache_clear(&frame->cache[1]);
 	free(frame->title);
 	free(frame);
 }
@@ -385,6 +437,8 @@ frame_set_title(struct frame *frame, const char *title)
 	free(frame->title);
 	frame->title = dup;
 
+	frame_cache_clear(&frame->cache[0]);
+	frame_cache_clear(&frame->cache[1]);
 	frame->geometry_dirty = 1;
 	frame->status |= FRAME_STATUS_REPAINT;
 
@@ -868,11 +922,183 @@ frame_double_click(struct frame *frame, void *data,
 	return location;
 }
 
+/* Splits the frame into the decoration strips, in user space. The strips
+ * cover the border, the title bar and all of the shadow, so that what
+ * lies between them is left transparent by theme_render_frame(). Returns
+ * 0 if the frame is too small to have anything between them. */
+static int
+frame_strip_rects(struct frame *frame, uint32_t flags,
+		  struct frame_rect *rects, struct frame_rect *center)
+{
+	int32_t top, bottom, left, right, reach;
+
+	if (flags & THEME_FRAME_MAXIMIZED)
+		reach = 0;
+	else
+		reach = FRAME_SHADOW_REACH;
+
+	left = max(frame->interior.x, reach);
+	top = max(frame->interior.y, reach);
+	right = max(frame->width - frame->interior.x -
+		    frame->interior.width, reach);
+	bottom = max(frame->height - frame->interior.y -
+		     frame->interior.height, reach);
+
+	center->x = left;
+	center->y = top;
+	center->width = frame->width - left - right;
+	center->height = frame->height - top - bottom;
+	if (center->width <= 0 || center->height <= 0)
+		return 0;
+
+	rects[FRAME_STRIP_TOP] =
+		(struct frame_rect) { 0, 0, frame->width, top };
+	rects[FRAME_STRIP_BOTTOM] =
+		(struct frame_rect) { 0, frame->height - bottom,
+				      frame->width, bottom };
+	rects[FRAME_STRIP_LEFT] =
+		(struct frame_rect) { 0, top, left, center->height };
+	rects[FRAME_STRIP_RIGHT] =
+		(struct frame_rect) { frame->width - right, top,
+				      right, center->height };
+
+	return 1;
+}
+
+/* Transforms a user space rectangle to device space. If outside is set
+ * the result covers every pixel the rectangle touches, otherwise only
+ * those it covers entirely. */
+static struct frame_rect
+frame_rect_to_device(cairo_t *cr, struct frame_rect *rect, int outside)
+{
+	struct frame_rect device;
+	double x[4], y[4], x1, y1, x2, y2;
+	int i;
+
+	x[0] = x[2] = rect->x;
+	x[1] = x[3] = rect->x + rect->width;
+	y[0] = y[1] = rect->y;
+	y[2] = y[3] = rect->y + rect->height;
+	x1 = y1 = HUGE_VAL;
+	x2 = y2 = -HUGE_VAL;
+	for (i = 0; i < 4; i++) {
+		cairo_user_to_device(cr, &x[i], &y[i]);
+		x1 = fmin(x1, x[i]);
+		y1 = fmin(y1, y[i]);
+		x2 = fmax(x2, x[i]);
+		y2 = fmax(y2, y[i]);
+	}
+
+	if (outside) {
+		device.x = floor(x1);
+		device.y = floor(y1);
+		device.width = ceil(x2) - device.x;
+		device.height = ceil(y2) - device.y;
+	} else {
+		device.x = ceil(x1);
+		device.y = ceil(y1);
+		device.width = floor(x2) - device.x;
+		device.height = floor(y2) - device.y;
+	}
+
+	return device;
+}
+
+/* Draws each strip of the decoration into a surface like the target of
+ * cr. A strip surface only keeps its part of what theme_render_frame()
+ * draws, since cairo clips to the surface. */
+static void
+frame_cache_render(struct frame *frame, struct frame_cache *cache,
+		   cairo_t *cr, struct frame_rect *rects)
+{
+	cairo_matrix_t matrix;
+	cairo_t *strip_cr;
+	struct frame_rect *device;
+	cairo_status_t status;
+	int i;
+
+	for (i = 0; i < FRAME_STRIP_COUNT; i++) {
+		device = &cache->rects[i];
+		*device = frame_rect_to_device(cr, &rects[i], 1);
+		cache->strips[i] =
+			cairo_surface_create_similar(cairo_get_target(cr),
+						     CAIRO_CONTENT_COLOR_ALPHA,
+						     device->width,
+						     device->height);
+
+		strip_cr = cairo_create(cache->strips[i]);
+		matrix = cache->matrix;
+		matrix.x0 -= device->x;
+		matrix.y0 -= device->y;
+		cairo_set_matrix(strip_cr, &matrix);
+		theme_render_frame(frame->theme, strip_cr,
+				   frame->width, frame->height,
+				   frame->title, &frame->buttons,
+				   cache->flags);
+		status = cairo_status(strip_cr);
+		cairo_destroy(strip_cr);
+
+		if (status != CAIRO_STATUS_SUCCESS) {
+			frame_cache_clear(cache);
+			return;
+		}
+	}
+
+	cache->valid = 1;
+}
+
+/* Returns the decoration cache for drawing to cr, brought up to date, or
+ * NULL if the decoration is to be drawn directly. While the frame is
+ * being resized its size changes with every repaint: the strips are only
+ * cached once it is repainted at the size it had the last time. */
+static struct frame_cache *
+frame_cache_update(struct frame *frame, cairo_t *cr, uint32_t flags,
+		   struct frame_rect *center)
+{
+	struct frame_cache *cache;
+	struct frame_rect rects[FRAME_STRIP_COUNT];
+	cairo_matrix_t matrix;
+
+	if (frame->cache_width != frame->width ||
+	    frame->cache_height != frame->height) {
+		frame_cache_clear(&frame->cache[0]);
+		frame_cache_clear(&frame->cache[1]);
+		frame->cache_width = frame->width;
+		frame->cache_height = frame->height;
+		return NULL;
+	}
+
+	/* The strips and the center are drawn as device space rectangles,
+	 * which only match the decoration if its edges stay axis aligned. */
+	cairo_get_matrix(cr, &matrix);
+	if ((matrix.xy != 0 || matrix.yx != 0) &&
+	    (matrix.xx != 0 || matrix.yy != 0))
+		return NULL;
+
+	if (!frame_strip_rects(frame, flags, rects, center))
+		return NULL;
+
+	cache = &frame->cache[!!(flags & THEME_FRAME_ACTIVE)];
+	if (cache->valid && cache->flags == flags &&
+	    memcmp(&cache->matrix, &matrix, sizeof matrix) == 0)
+		return cache;
+
+	frame_cache_clear(cache);
+	cache->flags = flags;
+	cache->matrix = matrix;
+	frame_cache_render(frame, cache, cr, rects);
+
+	return cache->valid ? cache : NULL;
+}
+
 void
 frame_repaint(struct frame *frame, cairo_t *cr)
 {
 	struct frame_button *button;
+	struct frame_cache *cache;
+	struct frame_rect center, *device;
 	uint32_t flags = 0;
+	int i;
 
 	frame_refresh_geometry(frame);
 
@@ -882,9 +1108,32 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 	if (frame->flags & FRAME_FLAG_ACTIVE)
 		flags |= THEME_FRAME_ACTIVE;
 
+	cache = frame_cache_update(frame, cr, flags, &center);
+
 	cairo_save(cr);
-	theme_render_frame(frame->theme, cr, frame->width, frame->height,
-			   frame->title, &frame->buttons, flags);
+	if (cache) {
+		/* Like theme_render_frame(), this replaces everything: the
+		 * strips, then the transparent rest */
+		center = frame_rect_to_device(cr, &center, 0);
+		cairo_identity_matrix(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		for (i = 0; i < FRAME_STRIP_COUNT; i++) {
+			device = &cache->rects[i];
+			cairo_set_source_surface(cr, cache->strips[i],
+						 device->x, device->y);
+			cairo_rectangle(cr, device->x, device->y,
+					device->width, device->height);
+			cairo_fill(cr);
+		}
+		cairo_set_source_rgba(cr, 0, 0, 0, 0);
+		cairo_rectangle(cr, center.x, center.y,
+				center.width, center.height);
+		cairo_fill(cr);
+	} else {
+		theme_render_frame(frame->theme, cr, frame->width,
+				   frame->height, frame->title,
+				   &frame->buttons, flags);
+	}
 	cairo_restore(cr);
 
 	wl_list_for_each(button, &frame->buttons, link)
@@ -23,10 +23,18 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <jpeglib.h>
 #include <png.h>
 #include <pixman.h>
@@ -72,8 +80,29 @@ pixman_image_destroy_func(pixman_image_t *image, void *data)
 	free(data);
 }
 
+/* Picks the largest DCT scaling that still covers width x height, so
+ * libjpeg skips the detail the caller would scale away anyway */
+static void
+jpeg_set_scale(struct jpeg_decompress_struct *cinfo, int width, int height)
+{
+	unsigned int denom;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	for (denom = 8; denom > 1; denom /= 2)
+		if ((cinfo->image_width + denom - 1) / denom >=
+		    (unsigned int) width &&
+		    (cinfo->image_height + denom - 1) / denom >=
+		    (unsigned int) height)
+			break;
+
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = denom;
+}
+
 static pixman_image_t *
-load_jpeg(FILE *fp)
+load_jpeg(FILE *fp, int width, int height)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
@@ -95,7 +124,13 @@ load_jpeg(FILE *fp)
 
 	jpeg_read_header(&cinfo, TRUE);
 
+	jpeg_set_scale(&cinfo, width, height);
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* libjpeg-turbo writes a8r8g8b8 itself, with 0xff in the X byte */
+	cinfo.out_color_space = JCS_EXT_BGRX;
+#else
 	cinfo.out_color_space = JCS_RGB;
+#endif
 	jpeg_start_decompress(&cinfo);
 
 	stride = cinfo.output_width * 4;
@@ -111,6 +146,8 @@ load_jpeg(FILE *fp)
 			rows[i] = data + (first + i) * stride;
 
 		jpeg_read_scanlines(&cinfo, rows, ARRAY_LENGTH(rows));
+		if (cinfo.output_components != 3)
+			continue;
 		for (i = 0; first + i < cinfo.output_scanline; i++)
 			swizzle_row(rows[i], cinfo.output_width);
 	}
@@ -138,6 +175,43 @@ multiply_alpha(int alpha, int color)
     return ((temp + (temp >> 8)) >> 8);
 }
 
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+typedef uint32_t v4su __attribute__ ((vector_size (16)));
+
+/* Four pixels at a time, branch free. This is multiply_alpha() on every
+ * channel, which already leaves the colors alone for alpha 0xff and
+ * clears them for alpha 0, so the results are the same as below. */
+static unsigned int
+premultiply_data_v4(png_bytep data, unsigned int size)
+{
+	v4su v, a, r, g, b;
+	unsigned int i;
+
+	for (i = 0; i + sizeof v <= size; i += sizeof v) {
+		memcpy(&v, data + i, sizeof v);
+
+		a = v >> 24;
+		r = a * (v & 0xff) + 0x80;
+		g = a * ((v >> 8) & 0xff) + 0x80;
+		b = a * ((v >> 16) & 0xff) + 0x80;
+		r = (r + (r >> 8)) >> 8;
+		g = (g + (g >> 8)) >> 8;
+		b = (b + (b >> 8)) >> 8;
+		v = (a << 24) | (r << 16) | (g << 8) | b;
+
+		memcpy(data + i, &v, sizeof v);
+	}
+
+	return i;
+}
+#else
+static unsigned int
+premultiply_data_v4(png_bytep data, unsigned int size)
+{
+	return 0;
+}
+#endif
+
 static void
 premultiply_data(png_structp   png,
 		 png_row_infop row_info,
@@ -146,7 +220,8 @@ premultiply_data(png_structp   png,
     unsigned int i;
     png_bytep p;
 
-    for (i = 0, p = data; i < row_info->rowbytes; i += 4, p += 4) {
+    i = premultiply_data_v4(data, row_info->rowbytes);
+    for (p = data + i; i < row_info->rowbytes; i += 4, p += 4) {
 	png_byte  alpha = p[3];
 	uint32_t w;
 
@@ -185,7 +260,7 @@ png_error_callback(png_structp png, png_const_charp error_msg)
 }
 
 static pixman_image_t *
-load_png(FILE *fp)
+load_png(FILE *fp, int request_width, int request_height)
 {
 	png_struct *png;
 	png_info *info;
@@ -287,11 +362,13 @@ load_png(FILE *fp)
 #ifdef HAVE_WEBP
 
 static pixman_image_t *
-load_webp(FILE *fp)
+load_webp(FILE *fp, int request_width, int request_height)
 {
 	WebPDecoderConfig config;
 	uint8_t buffer[16 * 1024];
-	int len;
+	pixman_image_t *image;
+	int len, width, height;
+	double sx, sy;
 	VP8StatusCode status;
 	WebPIDecoder *idec;
 
@@ -310,12 +387,27 @@ load_webp(FILE *fp)
 		return NULL;
 	}
 
-	config.output.colorspace = MODE_BGRA;
-	config.output.u.RGBA.stride = stride_for_width(config.input.width);
-	config.output.u.RGBA.size =
-		config.output.u.RGBA.stride * config.input.height;
-	config.output.u.RGBA.rgba =
-		malloc(config.output.u.RGBA.stride * config.input.height);
+	/* Let the decoder scale down to cover the requested size */
+	width = config.input.width;
+	height = config.input.height;
+	if (request_width > 0 && request_height > 0 &&
+	    request_width < width && request_height < height) {
+		sx = (double) request_width / width;
+		sy = (double) request_height / height;
+		if (sx < sy)
+			sx = sy;
+		width = width * sx + 0.999;
+		height = height * sx + 0.999;
+		config.options.use_scaling = 1;
+		config.options.scaled_width = width;
+		config.options.scaled_height = height;
+	}
+
+	/* Premultiplied, like the other loaders */
+	config.output.colorspace = MODE_bgrA;
+	config.output.u.RGBA.stride = stride_for_width(width);
+	config.output.u.RGBA.size = config.output.u.RGBA.stride * height;
+	config.output.u.RGBA.rgba = malloc(config.output.u.RGBA.size);
 	config.output.is_external_memory = 1;
 	if (!config.output.u.RGBA.rgba) {
 		WebPFreeDecBuffer(&config.output);
@@ -323,9 +415,9 @@ load_webp(FILE *fp)
 	}
 
 	rewind(fp);
-	idec = WebPINewDecoder(&config.output);
+	idec = WebPIDecode(NULL, 0, &config);
 	if (!idec) {
-		WebPFreeDecBuffer(&config.output);
+		free(config.output.u.RGBA.rgba);
 		return NULL;
 	}
 
@@ -335,7 +427,7 @@ load_webp(FILE *fp)
 		if (status != VP8_STATUS_OK) {
 			fprintf(stderr, "webp decode status %d\n", status);
 			WebPIDelete(idec);
-			WebPFreeDecBuffer(&config.output);
+			free(config.output.u.RGBA.rgba);
 			return NULL;
 		}
 	}
@@ -343,11 +435,14 @@ load_webp(FILE *fp)
 	WebPIDelete(idec);
 	WebPFreeDecBuffer(&config.output);
 
-	return pixman_image_create_bits(PIXMAN_a8r8g8b8,
-					config.input.width,
-					config.input.height,
-					(uint32_t *) config.output.u.RGBA.rgba,
-					config.output.u.RGBA.stride);
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+					 (uint32_t *) config.output.u.RGBA.rgba,
+					 config.output.u.RGBA.stride);
+
+	pixman_image_set_destroy_function(image, pixman_image_destroy_func,
+					  config.output.u.RGBA.rgba);
+
+	return image;
 }
 
 #endif
@@ -356,7 +451,7 @@ load_webp(FILE *fp)
 struct image_loader {
 	unsigned char header[4];
 	int header_size;
-	pixman_image_t *(*load)(FILE *fp);
+	pixman_image_t *(*load)(FILE *fp, int width, int height);
 };
 
 static const struct image_loader loaders[] = {
@@ -367,13 +462,270 @@ static const struct image_loader loaders[] = {
 #endif
 };
 
-pixman_image_t *
-load_image(const char *filename)
+/* Decoded images of at least this many pixels, like wallpapers, are kept
+ * in the cache directory, so that other outputs and the next start map
+ * the pixels instead of decoding the file again. Smaller images decode
+ * about as fast as the cache file reads. There is an entry per source
+ * file and requested size, so outputs of different sizes sharing an
+ * image each keep theirs, and the oldest entries are removed once the
+ * directory holds more than IMAGE_CACHE_MAX_SIZE. */
+#define IMAGE_CACHE_MIN_PIXELS	(1024 * 1024)
+#define IMAGE_CACHE_MAX_SIZE	(128 * 1024 * 1024)
+#define IMAGE_CACHE_MAGIC	0x474d4957	/* "WIMG" */
+#define IMAGE_CACHE_VERSION	1
+
+struct image_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	/* The source file, and the size it was decoded for */
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+	int32_t request_width, request_height;
+	/* The a8r8g8b8 pixels, at a page aligned offset */
+	int32_t width, height, stride;
+	uint32_t data_offset;
+};
+
+struct image_cache_map {
+	void *addr;
+	size_t size;
+};
+
+static int
+image_cache_path(char *path, size_t size, const struct stat *st,
+		 int width, int height)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	uint64_t key[4] = { st->st_dev, st->st_ino, width, height };
+	const unsigned char *p = (const unsigned char *) key;
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+	int len;
+
+	if (getenv("WESTON_IMAGE_NO_CACHE"))
+		return -1;
+
+	if (cache_home) {
+		len = snprintf(path, size, "%s/weston", cache_home);
+	} else if (home) {
+		snprintf(path, size, "%s/.cache", home);
+		mkdir(path, 0700);
+		len = snprintf(path, size, "%s/.cache/weston", home);
+	} else {
+		return -1;
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	/* One file per source file and size; a changed file replaces its
+	 * old entry instead of adding one */
+	for (i = 0; i < sizeof key; i++) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	if (snprintf(path + len, size - len, "/image-%08x", hash) >=
+	    (int) (size - len))
+		return -1;
+
+	return 0;
+}
+
+static void
+image_cache_header_init(struct image_cache_header *header,
+			const struct stat *st, int width, int height)
+{
+	memset(header, 0, sizeof *header);
+	header->magic = IMAGE_CACHE_MAGIC;
+	header->version = IMAGE_CACHE_VERSION;
+	header->dev = st->st_dev;
+	header->ino = st->st_ino;
+	header->size = st->st_size;
+	header->mtime_sec = st->st_mtim.tv_sec;
+	header->mtime_nsec = st->st_mtim.tv_nsec;
+	header->request_width = width;
+	header->request_height = height;
+}
+
+static void
+image_cache_unmap(pixman_image_t *image, void *data)
+{
+	struct image_cache_map *map = data;
+
+	munmap(map->addr, map->size);
+	free(map);
+}
+
+static pixman_image_t *
+image_cache_load(const char *path, const struct stat *source,
+		 int width, int height)
+{
+	struct image_cache_header header, expected;
+	struct image_cache_map *map;
+	pixman_image_t *image;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	image_cache_header_init(&expected, source, width, height);
+	if (fstat(fd, &st) < 0 ||
+	    pread(fd, &header, sizeof header, 0) != sizeof header ||
+	    memcmp(&header, &expected,
+		   offsetof(struct image_cache_header, width)) != 0 ||
+	    header.width <= 0 || header.height <= 0 ||
+	    header.width > 0x7fff || header.height > 0x7fff ||
+	    header.stride < header.width * 4 || header.stride % 4 != 0 ||
+	    header.data_offset < sizeof header ||
+	    header.data_offset % 4 != 0 ||
+	    (uint64_t) st.st_size < header.data_offset +
+	    (uint64_t) header.stride * header.height) {
+		close(fd);
+		return NULL;
+	}
+
+	map = malloc(sizeof *map);
+	if (map == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private, so whoever draws into the image doesn't write the
+	 * cache file */
+	map->size = st.st_size;
+	map->addr = mmap(NULL, map->size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->addr == MAP_FAILED) {
+		free(map);
+		return NULL;
+	}
+
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+					 header.width, header.height,
+					 (uint32_t *) ((char *) map->addr +
+						       header.data_offset),
+					 header.stride);
+	if (image == NULL) {
+		image_cache_unmap(NULL, map);
+		return NULL;
+	}
+
+	pixman_image_set_destroy_function(image, image_cache_unmap, map);
+
+	return image;
+}
+
+static void
+image_cache_store(const char *path, const struct stat *source,
+		  int width, int height, pixman_image_t *image)
+{
+	struct image_cache_header header;
+	char tmp[PATH_MAX + 8];
+	char *data;
+	long page_size;
+	int fd, ok, y;
+
+	image_cache_header_init(&header, source, width, height);
+	header.width = pixman_image_get_width(image);
+	header.height = pixman_image_get_height(image);
+	header.stride = pixman_image_get_stride(image);
+	data = (char *) pixman_image_get_data(image);
+
+	if ((int64_t) header.width * header.height < IMAGE_CACHE_MIN_PIXELS ||
+	    pixman_image_get_format(image) != PIXMAN_a8r8g8b8 ||
+	    header.stride < header.width * 4)
+		return;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size < (long) sizeof header)
+		page_size = 4096;
+	header.data_offset = page_size;
+	header.stride = header.width * 4;
+
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	ok = pwrite(fd, &header, sizeof header, 0) == sizeof header;
+	for (y = 0; ok && y < header.height; y++)
+		ok = pwrite(fd, data + (size_t) y *
+			    pixman_image_get_stride(image), header.stride,
+			    header.data_offset +
+			    (off_t) y * header.stride) == header.stride;
+
+	if (close(fd) < 0 || !ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+/* Removes the oldest entries from the directory of the cache file path,
+ * other than path itself, until it holds no more than
+ * IMAGE_CACHE_MAX_SIZE. Temporary files being written are left alone. */
+static void
+image_cache_trim(const char *path)
+{
+	char dir[PATH_MAX], oldest[NAME_MAX + 1];
+	const char *name = strrchr(path, '/') + 1;
+	struct dirent *de;
+	struct stat st;
+	time_t oldest_mtime;
+	off_t total;
+	DIR *d;
+	int ret;
+
+	snprintf(dir, sizeof dir, "%.*s", (int) (name - path - 1), path);
+
+	for (;;) {
+		d = opendir(dir);
+		if (d == NULL)
+			return;
+
+		total = 0;
+		oldest[0] = '\0';
+		oldest_mtime = 0;
+		while ((de = readdir(d)) != NULL) {
+			if (strncmp(de->d_name, "image-", 6) != 0 ||
+			    strchr(de->d_name, '.') != NULL ||
+			    fstatat(dirfd(d), de->d_name, &st,
+				    AT_SYMLINK_NOFOLLOW) < 0 ||
+			    !S_ISREG(st.st_mode))
+				continue;
+
+			total += st.st_size;
+			if (strcmp(de->d_name, name) != 0 &&
+			    (!oldest[0] || st.st_mtime < oldest_mtime)) {
+				snprintf(oldest, sizeof oldest, "%s",
+					 de->d_name);
+				oldest_mtime = st.st_mtime;
+			}
+		}
+
+		if (total > IMAGE_CACHE_MAX_SIZE && oldest[0])
+			ret = unlinkat(dirfd(d), oldest, 0);
+		else
+			ret = -1;
+		closedir(d);
+
+		if (ret < 0)
+			return;
+	}
+}
+
+static pixman_image_t *
+load_image_file(const char *filename, int width, int height)
 {
 	pixman_image_t *image;
 	unsigned char header[4];
+	char cache_path[PATH_MAX];
+	struct stat st;
 	FILE *fp;
 	unsigned int i;
+	int cached;
 
 	if (!filename || !*filename)
 		return NULL;
@@ -384,6 +736,17 @@ load_image(const char *filename)
 		return NULL;
 	}
 
+	cached = fstat(fileno(fp), &st) == 0 &&
+		 image_cache_path(cache_path, sizeof cache_path,
+				  &st, width, height) == 0;
+	if (cached) {
+		image = image_cache_load(cache_path, &st, width, height);
+		if (image) {
+			fclose(fp);
+			return image;
+		}
+	}
+
 	if (fread(header, sizeof header, 1, fp) != 1) {
 		fclose(fp);
 		fprintf(stderr, "%s: unable to read file header\n", filename);
@@ -394,7 +757,7 @@ load_image(const char *filename)
 	for (i = 0; i < ARRAY_LENGTH(loaders); i++) {
 		if (memcmp(header, loaders[i].header,
 			   loaders[i].header_size) == 0) {
-			image = loaders[i].load(fp);
+			image = loaders[i].load(fp, width, height);
 			break;
 		}
 	}
@@ -409,7 +772,25 @@ load_image(const char *filename)
 	} else if (!image) {
 		/* load probably printed something, but just in case */
 		fprintf(stderr, "%s: error reading image\n", filename);
+	} else if (cached) {
+		image_cache_store(cache_path, &st, width, height, image);
+		image_cache_trim(cache_path);
 	}
 
 	return image;
 }
+
+pixman_image_t *
+load_image(const char *filename)
+{
+	return load_image_file(filename, 0, 0);
+}
+
+pixman_image_t *
+load_image_scaled(const char *filename, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		width = height = 0;
+
+	return load_image_file(filename, width, height);
+}
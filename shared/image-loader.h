@@ -28,4 +28,11 @@
 pixman_image_t *
 load_image(const char *filename);
 
+/* Like load_image(), for an image that will be drawn scaled down to about
+ * width x height: decoders that can scale while decoding return the
+ * smallest such image that still covers that size, keeping the aspect
+ * ratio. Other images come back at their full size. */
+pixman_image_t *
+load_image_scaled(const char *filename, int width, int height);
+
 #endif
@@ -43,8 +43,40 @@
  *  1  5  9 13
  *  2  6 10 14
  *  3  7 11 15
+ *
+ * The type bits tell which elements can differ from the identity matrix:
+ *  0				none
+ *  TRANSLATE			12, 13 and 14
+ *  SCALE, without ROTATE	and the diagonal, 0, 5 and 10
+ *  ROTATE, without OTHER	and the upper left 3x3 block; the last row
+ *				stays 0 0 0 1, the matrix is affine
+ *  OTHER			any
+ * Translations and scales take shortcuts below, and so does inverting
+ * an affine transformation of the xy plane. The rest goes through four
+ * wide vector operations, which beat scalar shortcuts for rotations.
  */
 
+#ifdef __GNUC__
+/* Four floats, which GCC and clang map to SSE or NEON registers where
+ * the target has them, and to plain floats elsewhere. */
+typedef float v4sf __attribute__((vector_size(16)));
+
+static inline v4sf
+load_v4sf(const float *p)
+{
+	v4sf v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline void
+store_v4sf(float *p, v4sf v)
+{
+	memcpy(p, &v, sizeof v);
+}
+#endif
+
 WL_EXPORT void
 weston_matrix_init(struct weston_matrix *matrix)
 {
@@ -56,25 +88,62 @@ weston_matrix_init(struct weston_matrix *matrix)
 	memcpy(matrix, &identity, sizeof identity);
 }
 
+/* Column c of n * m is n times column c of m, that is the columns of n
+ * weighted by the elements of column c of m. */
+static void
+multiply_generic(float *r, const float *m, const float *n)
+{
+#ifdef __GNUC__
+	v4sf n0 = load_v4sf(n), n1 = load_v4sf(n + 4);
+	v4sf n2 = load_v4sf(n + 8), n3 = load_v4sf(n + 12);
+	int c;
+
+	for (c = 0; c < 16; c += 4)
+		store_v4sf(r + c, n0 * m[c] + n1 * m[c + 1] +
+				  n2 * m[c + 2] + n3 * m[c + 3]);
+#else
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		r[i] = 0;
+		for (j = 0; j < 4; j++)
+			r[i] += m[(i & ~3) + j] * n[(i & 3) + j * 4];
+	}
+#endif
+}
+
 /* m <- n * m, that is, m is multiplied on the LEFT. */
 WL_EXPORT void
 weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 {
 	struct weston_matrix tmp;
-	const float *row, *column;
-	div_t d;
-	int i, j;
+	unsigned int type = m->type | n->type;
+	int i;
 
-	for (i = 0; i < 16; i++) {
-		tmp.d[i] = 0;
-		d = div(i, 4);
-		row = m->d + d.quot * 4;
-		column = n->d + d.rem;
-		for (j = 0; j < 4; j++)
-			tmp.d[i] += row[j] * column[j * 4];
+	if (n->type == 0)
+		return;
+
+	if (m->type == 0) {
+		memcpy(m, n, sizeof *m);
+		return;
 	}
-	tmp.type = m->type | n->type;
-	memcpy(m, &tmp, sizeof tmp);
+
+	if (type == WESTON_MATRIX_TRANSFORM_TRANSLATE) {
+		for (i = 12; i < 15; i++)
+			m->d[i] += n->d[i];
+	} else if (!(type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+			     WESTON_MATRIX_TRANSFORM_OTHER))) {
+		for (i = 0; i < 3; i++) {
+			m->d[12 + i] = m->d[12 + i] * n->d[i * 5] +
+				       n->d[12 + i];
+			m->d[i * 5] *= n->d[i * 5];
+		}
+	} else {
+		multiply_generic(tmp.d, m->d, n->d);
+		memcpy(m->d, tmp.d, sizeof tmp.d);
+	}
+
+	m->type = type;
 }
 
 WL_EXPORT void
@@ -114,16 +183,86 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
-	int i, j;
-	struct weston_vector t;
+	const float *d = matrix->d;
+	float *f = v->f;
+	int i;
+
+	if (matrix->type == 0)
+		return;
+
+	if (matrix->type == WESTON_MATRIX_TRANSFORM_TRANSLATE) {
+		for (i = 0; i < 3; i++)
+			f[i] += f[3] * d[12 + i];
+	} else if (!(matrix->type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+				     WESTON_MATRIX_TRANSFORM_OTHER))) {
+		for (i = 0; i < 3; i++)
+			f[i] = f[i] * d[i * 5] + f[3] * d[12 + i];
+	} else {
+#ifdef __GNUC__
+		store_v4sf(f, load_v4sf(d) * f[0] + load_v4sf(d + 4) * f[1] +
+			      load_v4sf(d + 8) * f[2] +
+			      load_v4sf(d + 12) * f[3]);
+#else
+		struct weston_vector t;
+		int j;
 
-	for (i = 0; i < 4; i++) {
-		t.f[i] = 0;
-		for (j = 0; j < 4; j++)
-			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+		for (i = 0; i < 4; i++) {
+			t.f[i] = 0;
+			for (j = 0; j < 4; j++)
+				t.f[i] += f[j] * d[i + j * 4];
+		}
+		*v = t;
+#endif
 	}
+}
 
-	*v = t;
+/* Transforms the n points (x, y, 0, 1) in src, given as x, y pairs, into
+ * dst, dividing by w. Points whose w comes out too close to zero go to
+ * the origin and make it return -1. src and dst may be the same array. */
+WL_EXPORT int
+weston_matrix_transform_points(struct weston_matrix *matrix,
+			       float *dst, const float *src, int n)
+{
+	const float *d = matrix->d;
+	float x, y, w;
+	int i, ret = 0;
+
+	if (matrix->type == 0) {
+		memmove(dst, src, n * 2 * sizeof *dst);
+	} else if (matrix->type == WESTON_MATRIX_TRANSFORM_TRANSLATE) {
+		for (i = 0; i < n * 2; i += 2) {
+			dst[i] = src[i] + d[12];
+			dst[i + 1] = src[i + 1] + d[13];
+		}
+	} else if (!(matrix->type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+				     WESTON_MATRIX_TRANSFORM_OTHER))) {
+		for (i = 0; i < n * 2; i += 2) {
+			dst[i] = src[i] * d[0] + d[12];
+			dst[i + 1] = src[i + 1] * d[5] + d[13];
+		}
+	} else if (!(matrix->type & WESTON_MATRIX_TRANSFORM_OTHER)) {
+		for (i = 0; i < n * 2; i += 2) {
+			x = src[i];
+			y = src[i + 1];
+			dst[i] = x * d[0] + y * d[4] + d[12];
+			dst[i + 1] = x * d[1] + y * d[5] + d[13];
+		}
+	} else {
+		for (i = 0; i < n * 2; i += 2) {
+			x = src[i];
+			y = src[i + 1];
+			w = x * d[3] + y * d[7] + d[15];
+			if (fabsf(w) < 1e-6) {
+				dst[i] = dst[i + 1] = 0;
+				ret = -1;
+				continue;
+			}
+			dst[i] = (x * d[0] + y * d[4] + d[12]) / w;
+			dst[i + 1] = (x * d[1] + y * d[5] + d[13]) / w;
+		}
+	}
+
+	return ret;
 }
 
 static inline void
@@ -253,6 +392,63 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/* Inverts the matrices that only translate, scale and rotate in the xy
+ * plane directly. Returns -1 for anything else, and when a pivot is too
+ * small to tell here whether the matrix is invertible. */
+static int
+invert_2d(struct weston_matrix *inverse, const struct weston_matrix *matrix)
+{
+	const float *d = matrix->d;
+	double a, b, c, e, z, det;
+	float t[3];
+	int i;
+
+	if (matrix->type == 0) {
+		weston_matrix_init(inverse);
+		return 0;
+	}
+
+	if (matrix->type == WESTON_MATRIX_TRANSFORM_TRANSLATE) {
+		memcpy(t, &d[12], sizeof t);
+		weston_matrix_init(inverse);
+		for (i = 0; i < 3; i++)
+			inverse->d[12 + i] = -t[i];
+		inverse->type = matrix->type;
+		return 0;
+	}
+
+	if (matrix->type & WESTON_MATRIX_TRANSFORM_OTHER ||
+	    d[2] != 0 || d[6] != 0 || d[8] != 0 || d[9] != 0)
+		return -1;
+
+	/*  a c 0 x       e -c  0     -(e x - c y)
+	 *  b e 0 y  ->  -b  a  0  /  -(a y - b x)  / det
+	 *  0 0 z w       0  0  det/z -det w/z
+	 */
+	a = d[0];
+	b = d[1];
+	c = d[4];
+	e = d[5];
+	z = d[10];
+	det = a * e - b * c;
+	if (fabs(det) < 1e-9 || fabs(z) < 1e-9)
+		return -1;
+
+	memcpy(t, &d[12], sizeof t);
+	weston_matrix_init(inverse);
+	inverse->d[0] = e / det;
+	inverse->d[1] = -b / det;
+	inverse->d[4] = -c / det;
+	inverse->d[5] = a / det;
+	inverse->d[10] = 1.0 / z;
+	inverse->d[12] = -(e * t[0] - c * t[1]) / det;
+	inverse->d[13] = -(a * t[1] - b * t[0]) / det;
+	inverse->d[14] = -t[2] / z;
+	inverse->type = matrix->type;
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
@@ -261,6 +457,9 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	unsigned perm[4];	/* permutation */
 	unsigned c;
 
+	if (invert_2d(inverse, matrix) == 0)
+		return 0;
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
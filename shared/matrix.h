@@ -35,6 +35,9 @@ enum weston_matrix_transform_type {
 	WESTON_MATRIX_TRANSFORM_OTHER		= (1 << 3),
 };
 
+/* type is the set of transformations that went into d, which the
+ * operations rely on; filling in d by hand needs type set to match, or
+ * to WESTON_MATRIX_TRANSFORM_OTHER. */
 struct weston_matrix {
 	float d[16];
 	unsigned int type;
@@ -57,6 +60,9 @@ void
 weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin);
 void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v);
+int
+weston_matrix_transform_points(struct weston_matrix *matrix,
+			       float *dst, const float *src, int n);
 
 int
 weston_matrix_invert(struct weston_matrix *inverse,
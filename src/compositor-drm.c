@@ -48,6 +48,9 @@
 #include "gl-renderer.h"
 #include "pixman-renderer.h"
 #include "udev-input.h"
+#ifndef BUILD_LIBINPUT_BACKEND
+#include "evdev-thread.h"
+#endif
 #include "launcher-util.h"
 #include "vaapi-recorder.h"
 
@@ -98,6 +101,7 @@ struct drm_compositor {
 	uint32_t crtc_allocator;
 	uint32_t connector_allocator;
 	struct wl_listener session_listener;
+	struct wl_listener flush_damage_listener;
 	uint32_t format;
 
 	/* we need these parameters in order to not fail drmModeAddFB2()
@@ -114,6 +118,10 @@ struct drm_compositor {
 
 	int cursors_are_broken;
 
+	/* Planes, cursor and mode are set with one atomic commit per
+	 * output and frame, and sprite assignments are test-committed */
+	int atomic_modeset;
+
 	int use_pixman;
 
 	uint32_t prev_state;
@@ -146,6 +154,25 @@ struct drm_fb {
 	void *map;
 };
 
+/* A dumb buffer a fullscreen shm surface is copied to for scanout with
+ * the pixman renderer, the part of it that is out of date and the surface
+ * it was last copied from */
+struct drm_scanout_buffer {
+	struct drm_fb *fb;
+	pixman_region32_t damage;
+	struct weston_surface *surface;
+	struct wl_listener surface_destroy_listener;
+	/* The surface damage about to be flushed is already copied */
+	int damage_copied;
+};
+
+/* Property ids of a plane, for atomic commits */
+struct drm_plane_props {
+	uint32_t fb_id, crtc_id;
+	uint32_t src_x, src_y, src_w, src_h;
+	uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+};
+
 struct drm_edid {
 	char eisa_id[13];
 	char monitor_name[13];
@@ -182,8 +209,21 @@ struct drm_output {
 	int current_image;
 	pixman_region32_t previous_damage;
 
+	struct drm_scanout_buffer scanout[2];
+
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+
+	/* Atomic modesetting state, see drm_output_init_atomic() */
+	int atomic;
+	uint32_t crtc_active_prop, crtc_mode_prop, connector_crtc_prop;
+	uint32_t mode_blob_id;
+	uint32_t primary_plane_id;
+	struct drm_plane_props primary_props;
+	uint32_t cursor_plane_id;
+	struct drm_plane_props cursor_props;
+	uint32_t cursor_fb_id[2];
+	uint32_t cursor_fb;	/* the one to show, or 0 */
 };
 
 /*
@@ -201,6 +241,7 @@ struct drm_sprite {
 
 	uint32_t possible_crtcs;
 	uint32_t plane_id;
+	struct drm_plane_props props;
 	uint32_t count_formats;
 
 	int32_t src_x, src_y;
@@ -421,7 +462,8 @@ drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
 		return;
 
 	if (fb->map &&
-            (fb != output->dumb[0] && fb != output->dumb[1])) {
+	    fb != output->dumb[0] && fb != output->dumb[1] &&
+	    fb != output->scanout[0].fb && fb != output->scanout[1].fb) {
 		drm_fb_destroy_dumb(fb);
 	} else if (fb->bo) {
 		if (fb->is_client_buffer)
@@ -462,6 +504,143 @@ drm_output_check_scanout_format(struct drm_output *output,
 	return 0;
 }
 
+static void
+drm_scanout_buffer_set_surface(struct drm_scanout_buffer *scanout,
+			       struct weston_surface *surface)
+{
+	if (scanout->surface)
+		wl_list_remove(&scanout->surface_destroy_listener.link);
+
+	scanout->surface = surface;
+	if (surface)
+		wl_signal_add(&surface->destroy_signal,
+			      &scanout->surface_destroy_listener);
+}
+
+static void
+scanout_buffer_handle_surface_destroy(struct wl_listener *listener,
+				      void *data)
+{
+	struct drm_scanout_buffer *scanout =
+		container_of(listener, struct drm_scanout_buffer,
+			     surface_destroy_listener);
+
+	drm_scanout_buffer_set_surface(scanout, NULL);
+}
+
+/* Records surface damage in every scanout buffer filled from the surface,
+ * on all outputs, whichever output's repaint flushes it. */
+static void
+drm_compositor_handle_flush_damage(struct wl_listener *listener, void *data)
+{
+	struct drm_compositor *c =
+		container_of(listener, struct drm_compositor,
+			     flush_damage_listener);
+	struct weston_surface *surface = data;
+	struct drm_scanout_buffer *scanout;
+	struct drm_output *output;
+	int i;
+
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		for (i = 0; i < 2; i++) {
+			scanout = &output->scanout[i];
+			if (scanout->surface != surface)
+				continue;
+			if (scanout->damage_copied)
+				scanout->damage_copied = 0;
+			else
+				pixman_region32_union(&scanout->damage,
+						      &scanout->damage,
+						      &surface->damage);
+		}
+	}
+}
+
+/* The pixman renderer has no buffers to scan out from clients. Instead,
+ * copy what changed of a fullscreen shm surface into a dumb buffer and
+ * flip to that, rather than compositing the whole output. */
+static struct weston_plane *
+drm_output_prepare_shm_scanout_view(struct drm_output *output,
+				    struct weston_view *ev)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct weston_surface *es = ev->surface;
+	struct drm_scanout_buffer *scanout;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_region32_t r;
+	pixman_box32_t *rects;
+	uint8_t *src, *dst;
+	int n, y, stride, opaque;
+
+	shm_buffer = wl_shm_buffer_get(es->buffer_ref.buffer->resource);
+	if (!shm_buffer || ev->alpha != 1.0f ||
+	    es->buffer_viewport.buffer.src_width != wl_fixed_from_int(-1) ||
+	    es->buffer_viewport.surface.width != -1 ||
+	    output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    output->format != GBM_FORMAT_XRGB8888 ||
+	    output->base.current_scale != 1 ||
+	    es->buffer_viewport.buffer.scale != 1 ||
+	    es->width != output->base.width ||
+	    es->height != output->base.height)
+		return NULL;
+
+	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	case WL_SHM_FORMAT_XRGB8888:
+		break;
+	case WL_SHM_FORMAT_ARGB8888:
+		/* Scanout ignores alpha, so it has to be opaque. */
+		pixman_region32_init_rect(&r, 0, 0, es->width, es->height);
+		pixman_region32_subtract(&r, &r, &es->opaque);
+		opaque = !pixman_region32_not_empty(&r);
+		pixman_region32_fini(&r);
+		if (!opaque)
+			return NULL;
+		break;
+	default:
+		return NULL;
+	}
+
+	/* Copy to the buffer that is not on screen. */
+	scanout = &output->scanout[output->current == output->scanout[0].fb];
+	if (!scanout->fb) {
+		scanout->fb = drm_fb_create_dumb(c, output->base.width,
+						 output->base.height);
+		if (!scanout->fb)
+			return NULL;
+	}
+
+	if (scanout->surface != es) {
+		pixman_region32_fini(&scanout->damage);
+		pixman_region32_init_rect(&scanout->damage, 0, 0,
+					  es->width, es->height);
+		drm_scanout_buffer_set_surface(scanout, es);
+	}
+
+	/* The damage of this repaint is only flushed, and recorded for
+	 * the other buffers, after the planes are assigned. */
+	pixman_region32_union(&scanout->damage, &scanout->damage, &es->damage);
+	scanout->damage_copied = 1;
+
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	src = wl_shm_buffer_get_data(shm_buffer);
+	dst = scanout->fb->map;
+	rects = pixman_region32_rectangles(&scanout->damage, &n);
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (; n > 0; n--, rects++)
+		for (y = rects->y1; y < rects->y2; y++)
+			memcpy(dst + y * scanout->fb->stride + rects->x1 * 4,
+			       src + y * stride + rects->x1 * 4,
+			       (rects->x2 - rects->x1) * 4);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	pixman_region32_clear(&scanout->damage);
+	output->next = scanout->fb;
+
+	return &output->fb_plane;
+}
+
 static struct weston_plane *
 drm_output_prepare_scanout_view(struct weston_output *_output,
 				struct weston_view *ev)
@@ -476,13 +655,19 @@ drm_output_prepare_scanout_view(struct weston_output *_output,
 
 	if (ev->geometry.x != output->base.x ||
 	    ev->geometry.y != output->base.y ||
-	    buffer == NULL || c->gbm == NULL ||
+	    buffer == NULL ||
 	    buffer->width != output->base.current_mode->width ||
 	    buffer->height != output->base.current_mode->height ||
 	    output->base.transform != viewport->buffer.transform ||
 	    ev->transform.enabled)
 		return NULL;
 
+	if (c->use_pixman)
+		return drm_output_prepare_shm_scanout_view(output, ev);
+
+	if (c->gbm == NULL)
+		return NULL;
+
 	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
 			   buffer->resource, GBM_BO_USE_SCANOUT);
 
@@ -546,6 +731,10 @@ drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 
 	output->current_image ^= 1;
 
+	/* The next shm scanout copies the whole surface again. */
+	drm_scanout_buffer_set_surface(&output->scanout[0], NULL);
+	drm_scanout_buffer_set_surface(&output->scanout[1], NULL);
+
 	output->next = output->dumb[output->current_image];
 	pixman_renderer_output_set_buffer(&output->base,
 					  output->image[output->current_image]);
@@ -592,6 +781,385 @@ drm_output_set_gamma(struct weston_output *output_base,
 		weston_log("set gamma failed: %m\n");
 }
 
+static void
+drm_output_flip_sprites(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (s->output != output)
+			continue;
+
+		drm_output_release_fb(output, s->current);
+		s->current = s->next;
+		s->next = NULL;
+	}
+}
+
+static int
+drm_output_has_atomic_cursor(struct drm_output *output)
+{
+	return output->atomic && output->cursor_plane_id &&
+		output->cursor_fb_id[0] && output->cursor_fb_id[1];
+}
+
+#ifdef HAVE_DRM_ATOMIC
+static const struct {
+	const char *name;
+	size_t offset;
+} plane_prop_names[] = {
+	{ "FB_ID", offsetof(struct drm_plane_props, fb_id) },
+	{ "CRTC_ID", offsetof(struct drm_plane_props, crtc_id) },
+	{ "SRC_X", offsetof(struct drm_plane_props, src_x) },
+	{ "SRC_Y", offsetof(struct drm_plane_props, src_y) },
+	{ "SRC_W", offsetof(struct drm_plane_props, src_w) },
+	{ "SRC_H", offsetof(struct drm_plane_props, src_h) },
+	{ "CRTC_X", offsetof(struct drm_plane_props, crtc_x) },
+	{ "CRTC_Y", offsetof(struct drm_plane_props, crtc_y) },
+	{ "CRTC_W", offsetof(struct drm_plane_props, crtc_w) },
+	{ "CRTC_H", offsetof(struct drm_plane_props, crtc_h) },
+};
+
+/* Returns the id of the property of a kms object called name, and its
+ * value in value if not NULL, or 0 if there is no such property. */
+static uint32_t
+drm_object_get_prop(int fd, uint32_t obj_id, uint32_t obj_type,
+		    const char *name, uint64_t *value)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t i, id = 0;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props)
+		return 0;
+
+	for (i = 0; i < props->count_props && id == 0; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, name)) {
+			id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+static int
+drm_plane_get_props(int fd, uint32_t plane_id,
+		    struct drm_plane_props *props, uint64_t *type)
+{
+	uint32_t *id;
+	unsigned int i;
+
+	if (!drm_object_get_prop(fd, plane_id, DRM_MODE_OBJECT_PLANE,
+				 "type", type))
+		return -1;
+
+	for (i = 0; i < ARRAY_LENGTH(plane_prop_names); i++) {
+		id = (uint32_t *) ((char *) props + plane_prop_names[i].offset);
+		*id = drm_object_get_prop(fd, plane_id, DRM_MODE_OBJECT_PLANE,
+					  plane_prop_names[i].name, NULL);
+		if (*id == 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Coordinates are in 16.16 fixed point for the source, and in pixels for
+ * the crtc. A plane without fb is turned off. */
+static int
+drm_plane_add(drmModeAtomicReq *req, uint32_t plane_id,
+	      const struct drm_plane_props *props, uint32_t crtc_id,
+	      uint32_t fb_id, int32_t src_x, int32_t src_y,
+	      uint32_t src_w, uint32_t src_h, int32_t crtc_x, int32_t crtc_y,
+	      uint32_t crtc_w, uint32_t crtc_h)
+{
+	int ret = 0;
+
+	if (fb_id == 0)
+		crtc_id = 0;
+
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->fb_id, fb_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->crtc_id, crtc_id) < 0;
+	if (fb_id == 0)
+		return ret ? -1 : 0;
+
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->src_x, src_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->src_y, src_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->src_w, src_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->src_h, src_h) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->crtc_x, crtc_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->crtc_y, crtc_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->crtc_w, crtc_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, plane_id,
+					props->crtc_h, crtc_h) < 0;
+
+	return ret ? -1 : 0;
+}
+
+/* Builds the complete state of the output, with fb on the primary plane:
+ * the sprites used on it, the cursor and, for a modeset, the mode. */
+static drmModeAtomicReq *
+drm_output_get_atomic_state(struct drm_output *output, struct drm_fb *fb,
+			    int modeset)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct weston_mode *mode = output->base.current_mode;
+	drmModeAtomicReq *req;
+	struct drm_sprite *s;
+	uint32_t fb_id;
+	int ret = 0;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return NULL;
+
+	if (modeset) {
+		ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+						output->crtc_active_prop,
+						1) < 0;
+		ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+						output->crtc_mode_prop,
+						output->mode_blob_id) < 0;
+		ret |= drmModeAtomicAddProperty(req, output->connector_id,
+						output->connector_crtc_prop,
+						output->crtc_id) < 0;
+	}
+
+	ret |= drm_plane_add(req, output->primary_plane_id,
+			     &output->primary_props, output->crtc_id,
+			     fb->fb_id, 0, 0,
+			     mode->width << 16, mode->height << 16,
+			     0, 0, mode->width, mode->height);
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if ((!s->current && !s->next) || s->output != output)
+			continue;
+
+		fb_id = 0;
+		if (s->next && !c->sprites_hidden)
+			fb_id = s->next->fb_id;
+
+		ret |= drm_plane_add(req, s->plane_id, &s->props,
+				     output->crtc_id, fb_id,
+				     s->src_x, s->src_y, s->src_w, s->src_h,
+				     s->dest_x, s->dest_y,
+				     s->dest_w, s->dest_h);
+	}
+
+	if (drm_output_has_atomic_cursor(output))
+		ret |= drm_plane_add(req, output->cursor_plane_id,
+				     &output->cursor_props, output->crtc_id,
+				     output->cursor_fb, 0, 0,
+				     c->cursor_width << 16,
+				     c->cursor_height << 16,
+				     output->cursor_plane.x,
+				     output->cursor_plane.y,
+				     c->cursor_width, c->cursor_height);
+
+	if (ret) {
+		drmModeAtomicFree(req);
+		return NULL;
+	}
+
+	return req;
+}
+
+/* Asks the kernel whether the output can be shown with the sprites as
+ * assigned so far, without changing anything. */
+static int
+drm_output_test_planes(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	drmModeAtomicReq *req;
+	struct drm_fb *fb;
+	int ret;
+
+	/* The primary plane either scans out a client buffer already, or
+	 * will show a buffer like the current one. */
+	fb = output->next ? output->next : output->current;
+	if (!fb)
+		return -1;
+
+	req = drm_output_get_atomic_state(output, fb, 0);
+	if (!req)
+		return -1;
+
+	ret = drmModeAtomicCommit(c->drm.fd, req,
+				  DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+static int
+drm_output_repaint_atomic(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_mode *mode;
+	drmModeAtomicReq *req;
+	struct drm_sprite *s;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	int modeset, ret;
+
+	modeset = !output->current ||
+		output->current->stride != output->next->stride;
+	if (modeset) {
+		mode = container_of(output->base.current_mode,
+				    struct drm_mode, base);
+		if (output->mode_blob_id)
+			drmModeDestroyPropertyBlob(c->drm.fd,
+						   output->mode_blob_id);
+		output->mode_blob_id = 0;
+		if (drmModeCreatePropertyBlob(c->drm.fd, &mode->mode_info,
+					      sizeof mode->mode_info,
+					      &output->mode_blob_id)) {
+			weston_log("failed to create mode blob: %m\n");
+			goto err;
+		}
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	} else {
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	}
+
+	/* Updates the cursor image, and the state we commit below. */
+	drm_output_set_cursor(output);
+
+	req = drm_output_get_atomic_state(output, output->next, modeset);
+	if (!req) {
+		weston_log("failed to build atomic request\n");
+		goto err;
+	}
+
+	ret = drmModeAtomicCommit(c->drm.fd, req, flags, output);
+	drmModeAtomicFree(req);
+	if (ret) {
+		weston_log("atomic commit failed: %m\n");
+		goto err;
+	}
+
+	if (modeset)
+		output->base.set_dpms(&output->base, WESTON_DPMS_ON);
+
+	output->page_flip_pending = 1;
+
+	return 0;
+
+err:
+	output->cursor_view = NULL;
+	drm_output_release_fb(output, output->next);
+	output->next = NULL;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (s->output != output || !s->next)
+			continue;
+		drm_output_release_fb(output, s->next);
+		s->next = NULL;
+	}
+
+	return -1;
+}
+
+/* Picks the primary and cursor planes of the crtc of the output, and the
+ * properties an atomic commit sets. Without them the output stays on the
+ * legacy interfaces. */
+static void
+drm_output_init_atomic(struct drm_compositor *c, struct drm_output *output)
+{
+	drmModePlaneRes *plane_res;
+	drmModePlane *plane;
+	struct drm_plane_props props;
+	struct drm_output *other;
+	uint64_t type;
+	uint32_t i, id;
+	int claimed;
+
+	output->crtc_active_prop =
+		drm_object_get_prop(c->drm.fd, output->crtc_id,
+				    DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+	output->crtc_mode_prop =
+		drm_object_get_prop(c->drm.fd, output->crtc_id,
+				    DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+	output->connector_crtc_prop =
+		drm_object_get_prop(c->drm.fd, output->connector_id,
+				    DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+	if (!output->crtc_active_prop || !output->crtc_mode_prop ||
+	    !output->connector_crtc_prop) {
+		weston_log("missing atomic crtc or connector properties\n");
+		return;
+	}
+
+	plane_res = drmModeGetPlaneResources(c->drm.fd);
+	if (!plane_res)
+		return;
+
+	for (i = 0; i < plane_res->count_planes; i++) {
+		plane = drmModeGetPlane(c->drm.fd, plane_res->planes[i]);
+		if (!plane)
+			continue;
+
+		id = plane->plane_id;
+		if (!(plane->possible_crtcs & (1 << output->pipe)) ||
+		    drm_plane_get_props(c->drm.fd, id, &props, &type) < 0) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+		drmModeFreePlane(plane);
+
+		claimed = 0;
+		wl_list_for_each(other, &c->base.output_list, base.link)
+			if (other->primary_plane_id == id ||
+			    other->cursor_plane_id == id)
+				claimed = 1;
+		if (claimed)
+			continue;
+
+		if (type == DRM_PLANE_TYPE_PRIMARY &&
+		    !output->primary_plane_id) {
+			output->primary_plane_id = id;
+			output->primary_props = props;
+		} else if (type == DRM_PLANE_TYPE_CURSOR &&
+			   !output->cursor_plane_id) {
+			output->cursor_plane_id = id;
+			output->cursor_props = props;
+		}
+	}
+
+	drmModeFreePlaneResources(plane_res);
+
+	if (!output->primary_plane_id) {
+		weston_log("no primary plane for crtc %d\n", output->crtc_id);
+		return;
+	}
+
+	output->atomic = 1;
+}
+#endif
+
 static int
 drm_output_repaint(struct weston_output *output_base,
 		   pixman_region32_t *damage)
@@ -606,11 +1174,19 @@ drm_output_repaint(struct weston_output *output_base,
 	if (output->destroy_pending)
 		return -1;
 
+	output->scanout[0].damage_copied = 0;
+	output->scanout[1].damage_copied = 0;
+
 	if (!output->next)
 		drm_output_render(output, damage);
 	if (!output->next)
 		return -1;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (output->atomic)
+		return drm_output_repaint_atomic(output);
+#endif
+
 	mode = container_of(output->base.current_mode, struct drm_mode, base);
 	if (!output->current ||
 	    output->current->stride != output->next->stride) {
@@ -765,6 +1341,10 @@ page_flip_handler(int fd, unsigned int frame,
 		drm_output_release_fb(output, output->current);
 		output->current = output->next;
 		output->next = NULL;
+
+		/* The sprites went with the same commit. */
+		if (output->atomic)
+			drm_output_flip_sprites(output);
 	}
 
 	output->page_flip_pending = 0;
@@ -824,6 +1404,7 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 {
 	struct weston_compositor *ec = output_base->compositor;
 	struct drm_compositor *c =(struct drm_compositor *) ec;
+	struct drm_output *output = (struct drm_output *) output_base;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
 	struct drm_sprite *s;
 	int found = 0;
@@ -845,6 +1426,10 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 	if (c->sprites_are_broken)
 		return NULL;
 
+	/* Sprites are only safe where assignments can be tested. */
+	if (c->atomic_modeset && !output->atomic)
+		return NULL;
+
 	if (ev->output_mask != (1u << output_base->id))
 		return NULL;
 
@@ -864,6 +1449,10 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 		if (!drm_sprite_crtc_supported(output_base, s->possible_crtcs))
 			continue;
 
+		/* Still showing on another output */
+		if (s->current && s->output != output)
+			continue;
+
 		if (!s->next) {
 			found = 1;
 			break;
@@ -959,6 +1548,16 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 	s->src_h = (tbox.y2 - tbox.y1) << 8;
 	pixman_region32_fini(&src_rect);
 
+	s->output = output;
+
+#ifdef HAVE_DRM_ATOMIC
+	if (output->atomic && drm_output_test_planes(output) < 0) {
+		drm_output_release_fb(output, s->next);
+		s->next = NULL;
+		return NULL;
+	}
+#endif
+
 	return &s->plane;
 }
 
@@ -993,6 +1592,60 @@ drm_output_prepare_cursor_view(struct weston_output *output_base,
 	return &output->cursor_plane;
 }
 
+#ifndef BUILD_LIBINPUT_BACKEND
+static void
+drm_output_move_cursor(void *data, int32_t x, int32_t y)
+{
+	struct drm_output *output = data;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	static int failed_logged;
+
+	if (drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y) &&
+	    !failed_logged) {
+		weston_log("input thread failed to move cursor: %m\n");
+		failed_logged = 1;
+	}
+}
+
+/* Hands the cursor to the input thread, which moves it from here on
+ * until the next repaint. Not for atomic outputs: a legacy cursor move
+ * would race their nonblocking commits, and the next commit would put
+ * the cursor plane back where the thread found it. */
+static int
+drm_output_set_thread_cursor(struct drm_output *output,
+			     struct weston_view *ev)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct evdev_thread_cursor cursor;
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &c->base.seat_list, link) {
+		if (seat->pointer && seat->pointer->sprite == ev)
+			break;
+	}
+	if (&seat->link == &c->base.seat_list)
+		return -1;
+
+	cursor.seat = seat;
+	cursor.x = seat->pointer->x;
+	cursor.y = seat->pointer->y;
+	cursor.hotspot_x = seat->pointer->hotspot_x;
+	cursor.hotspot_y = seat->pointer->hotspot_y;
+	cursor.scale = output->base.current_scale;
+	cursor.area.x1 = output->base.x;
+	cursor.area.y1 = output->base.y;
+	cursor.area.x2 = output->base.x + output->base.width;
+	cursor.area.y2 = output->base.y + output->base.height;
+	cursor.move = drm_output_move_cursor;
+	cursor.data = output;
+	evdev_thread_set_cursor(c->input.thread, &cursor);
+
+	return 0;
+}
+#endif
+
 static void
 drm_output_set_cursor(struct drm_output *output)
 {
@@ -1008,7 +1661,13 @@ drm_output_set_cursor(struct drm_output *output)
 
 	output->cursor_view = NULL;
 	if (ev == NULL) {
-		drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+#ifndef BUILD_LIBINPUT_BACKEND
+		if (c->input.thread)
+			evdev_thread_clear_cursor(c->input.thread, output);
+#endif
+		output->cursor_fb = 0;
+		if (!drm_output_has_atomic_cursor(output))
+			drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
 		return;
 	}
 
@@ -1033,7 +1692,9 @@ drm_output_set_cursor(struct drm_output *output)
 			weston_log("failed update cursor: %m\n");
 
 		handle = gbm_bo_get_handle(bo).s32;
-		if (drmModeSetCursor(c->drm.fd, output->crtc_id, handle,
+		if (drm_output_has_atomic_cursor(output)) {
+			/* Shown by the commit of the frame */
+		} else if (drmModeSetCursor(c->drm.fd, output->crtc_id, handle,
 				c->cursor_width, c->cursor_height)) {
 			weston_log("failed to set cursor: %m\n");
 			c->cursors_are_broken = 1;
@@ -1042,6 +1703,19 @@ drm_output_set_cursor(struct drm_output *output)
 
 	x = (ev->geometry.x - output->base.x) * output->base.current_scale;
 	y = (ev->geometry.y - output->base.y) * output->base.current_scale;
+	if (drm_output_has_atomic_cursor(output)) {
+		output->cursor_fb = output->cursor_fb_id[output->current_cursor];
+		output->cursor_plane.x = x;
+		output->cursor_plane.y = y;
+		return;
+	}
+#ifndef BUILD_LIBINPUT_BACKEND
+	if (c->input.thread && drm_output_set_thread_cursor(output, ev) == 0) {
+		output->cursor_plane.x = x;
+		output->cursor_plane.y = y;
+		return;
+	}
+#endif
 	if (output->cursor_plane.x != x || output->cursor_plane.y != y) {
 		if (drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y)) {
 			weston_log("failed to move cursor: %m\n");
@@ -1053,6 +1727,32 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+/* Surfaces updating at least this often, in updates per second, are put
+ * on sprites. Once there, they stay until they drop below half of it. */
+#define DRM_SPRITE_UPDATE_RATE 10.0f
+
+/* Sprites are few, so keep them for surfaces that would otherwise make
+ * the primary plane repaint all the time, such as video and animations.
+ * Static content composited once on the primary plane costs nothing, and
+ * neither do small partial updates. */
+static int
+drm_view_wants_sprite(struct weston_view *ev, uint32_t now)
+{
+	struct weston_surface *es = ev->surface;
+	float threshold = DRM_SPRITE_UPDATE_RATE;
+	float rate, damage_rate;
+
+	if (ev->plane != &es->compositor->primary_plane)
+		threshold /= 2;
+
+	rate = weston_surface_get_update_rate(es, now, &damage_rate);
+	if (rate < threshold)
+		return 0;
+
+	/* At least a quarter of the surface per update */
+	return damage_rate / rate * 4 >= (float) es->width * es->height;
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
@@ -1061,11 +1761,12 @@ drm_assign_planes(struct weston_output *output)
 	struct weston_view *ev, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	uint32_t now = weston_compositor_get_time();
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
 	 * 1) size
-	 * 2) frequency of update
+	 * 2) frequency of update, see drm_view_wants_sprite()
 	 * 3) opacity (though some hw might support alpha blending)
 	 * 4) clipping (this can be fixed with color keys)
 	 *
@@ -1108,7 +1809,7 @@ drm_assign_planes(struct weston_output *output)
 			next_plane = drm_output_prepare_cursor_view(output, ev);
 		if (next_plane == NULL)
 			next_plane = drm_output_prepare_scanout_view(output, ev);
-		if (next_plane == NULL)
+		if (next_plane == NULL && drm_view_wants_sprite(ev, now))
 			next_plane = drm_output_prepare_overlay_view(output, ev);
 		if (next_plane == NULL)
 			next_plane = primary;
@@ -1132,6 +1833,7 @@ drm_output_destroy(struct weston_output *output_base)
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->base.compositor;
 	drmModeCrtcPtr origcrtc = output->original_crtc;
+	int i;
 
 	if (output->page_flip_pending) {
 		output->destroy_pending = 1;
@@ -1145,7 +1847,18 @@ drm_output_destroy(struct weston_output *output_base)
 	drmModeFreeProperty(output->dpms_prop);
 
 	/* Turn off hardware cursor */
+#ifndef BUILD_LIBINPUT_BACKEND
+	if (c->input.thread)
+		evdev_thread_clear_cursor(c->input.thread, output);
+#endif
 	drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+	for (i = 0; i < 2; i++)
+		if (output->cursor_fb_id[i])
+			drmModeRmFB(c->drm.fd, output->cursor_fb_id[i]);
+#ifdef HAVE_DRM_ATOMIC
+	if (output->mode_blob_id)
+		drmModeDestroyPropertyBlob(c->drm.fd, output->mode_blob_id);
+#endif
 
 	/* Restore original CRTC state */
 	drmModeSetCrtc(c->drm.fd, origcrtc->crtc_id, origcrtc->buffer_id,
@@ -1310,6 +2023,7 @@ init_drm(struct drm_compositor *ec, struct udev_device *device)
 		ec->clock = CLOCK_MONOTONIC;
 	else
 		ec->clock = CLOCK_REALTIME;
+	weston_compositor_set_presentation_clock(&ec->base, ec->clock);
 
 	ret = drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &cap);
 	if (ret == 0)
@@ -1323,6 +2037,18 @@ init_drm(struct drm_compositor *ec, struct udev_device *device)
 	else
 		ec->cursor_height = 64;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (getenv("WESTON_DISABLE_ATOMIC") == NULL &&
+	    drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0) {
+		if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0)
+			ec->atomic_modeset = 1;
+		else
+			drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
+	}
+#endif
+	weston_log("%s atomic modesetting\n",
+		   ec->atomic_modeset ? "using" : "not using");
+
 	return 0;
 }
 
@@ -1555,6 +2281,30 @@ find_crtc_for_connector(struct drm_compositor *ec,
 	return -1;
 }
 
+/* The cursor plane takes framebuffers like any other plane. Without them
+ * the legacy cursor ioctls are used. */
+static void
+drm_output_init_cursor_fbs(struct drm_output *output, struct drm_compositor *ec)
+{
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (output->cursor_fb_id[i])
+			continue;
+
+		handles[0] = gbm_bo_get_handle(output->cursor_bo[i]).u32;
+		pitches[0] = gbm_bo_get_stride(output->cursor_bo[i]);
+		if (drmModeAddFB2(ec->drm.fd, ec->cursor_width,
+				  ec->cursor_height, GBM_FORMAT_ARGB8888,
+				  handles, pitches, offsets,
+				  &output->cursor_fb_id[i], 0)) {
+			weston_log("failed to create cursor fb: %m\n");
+			output->cursor_fb_id[i] = 0;
+		}
+	}
+}
+
 /* Init output state that depends on gl or gbm */
 static int
 drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
@@ -1595,6 +2345,8 @@ drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
 	if (output->cursor_bo[0] == NULL || output->cursor_bo[1] == NULL) {
 		weston_log("cursor buffers unavailable, using gl cursors\n");
 		ec->cursors_are_broken = 1;
+	} else if (output->atomic && output->cursor_plane_id) {
+		drm_output_init_cursor_fbs(output, ec);
 	}
 
 	return 0;
@@ -1628,6 +2380,12 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 	pixman_region32_init_rect(&output->previous_damage,
 				  output->base.x, output->base.y, output->base.width, output->base.height);
 
+	for (i = 0; i < ARRAY_LENGTH(output->scanout); i++) {
+		pixman_region32_init(&output->scanout[i].damage);
+		output->scanout[i].surface_destroy_listener.notify =
+			scanout_buffer_handle_surface_destroy;
+	}
+
 	return 0;
 
 err:
@@ -1658,6 +2416,14 @@ drm_output_fini_pixman(struct drm_output *output)
 		output->dumb[i] = NULL;
 		output->image[i] = NULL;
 	}
+
+	for (i = 0; i < ARRAY_LENGTH(output->scanout); i++) {
+		drm_scanout_buffer_set_surface(&output->scanout[i], NULL);
+		if (output->scanout[i].fb)
+			drm_fb_destroy_dumb(output->scanout[i].fb);
+		pixman_region32_fini(&output->scanout[i].damage);
+		output->scanout[i].fb = NULL;
+	}
 }
 
 static void
@@ -2077,6 +2843,11 @@ create_output_for_connector(struct drm_compositor *ec,
 
 	output->base.current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (ec->atomic_modeset)
+		drm_output_init_atomic(ec, output);
+#endif
+
 	weston_output_init(&output->base, &ec->base, x, y,
 			   connector->mmWidth, connector->mmHeight,
 			   transform, scale);
@@ -2162,6 +2933,10 @@ create_sprites(struct drm_compositor *ec)
 	struct drm_sprite *sprite;
 	drmModePlaneRes *plane_res;
 	drmModePlane *plane;
+#ifdef HAVE_DRM_ATOMIC
+	struct drm_plane_props props;
+	uint64_t type;
+#endif
 	uint32_t i;
 
 	plane_res = drmModeGetPlaneResources(ec->drm.fd);
@@ -2176,6 +2951,18 @@ create_sprites(struct drm_compositor *ec)
 		if (!plane)
 			continue;
 
+#ifdef HAVE_DRM_ATOMIC
+		/* With universal planes, primary and cursor planes are
+		 * listed too; outputs pick theirs themselves. */
+		if (ec->atomic_modeset &&
+		    (drm_plane_get_props(ec->drm.fd, plane->plane_id,
+					 &props, &type) < 0 ||
+		     type != DRM_PLANE_TYPE_OVERLAY)) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+#endif
+
 		sprite = zalloc(sizeof(*sprite) + ((sizeof(uint32_t)) *
 						   plane->count_formats));
 		if (!sprite) {
@@ -2187,6 +2974,10 @@ create_sprites(struct drm_compositor *ec)
 
 		sprite->possible_crtcs = plane->possible_crtcs;
 		sprite->plane_id = plane->plane_id;
+#ifdef HAVE_DRM_ATOMIC
+		if (ec->atomic_modeset)
+			sprite->props = props;
+#endif
 		sprite->current = NULL;
 		sprite->next = NULL;
 		sprite->compositor = ec;
@@ -2792,6 +3583,9 @@ drm_compositor_create(struct wl_display *display,
 	ec->base.wl_display = display;
 	ec->session_listener.notify = session_notify;
 	wl_signal_add(&ec->base.session_signal, &ec->session_listener);
+	ec->flush_damage_listener.notify = drm_compositor_handle_flush_damage;
+	wl_signal_add(&ec->base.flush_damage_signal,
+		      &ec->flush_damage_listener);
 
 	drm_device = find_primary_gpu(ec, param->seat_id);
 	if (drm_device == NULL) {
@@ -2805,6 +3599,10 @@ drm_compositor_create(struct wl_display *display,
 		goto err_udev_dev;
 	}
 
+	/* Sprite assignments are tested with the kernel before use. */
+	if (ec->atomic_modeset)
+		ec->sprites_are_broken = 0;
+
 	if (ec->use_pixman) {
 		if (init_pixman(ec) < 0) {
 			weston_log("failed to initialize pixman renderer\n");
@@ -2830,15 +3628,13 @@ drm_compositor_create(struct wl_display *display,
 	wl_list_init(&ec->sprite_list);
 	create_sprites(ec);
 
-	if (udev_input_init(&ec->input,
-			    &ec->base, ec->udev, param->seat_id) < 0) {
-		weston_log("failed to create input devices\n");
-		goto err_sprite;
-	}
-
+	/* Outputs first: probing them overlaps with the keymap compiling
+	 * on its thread, which the first keyboard found by
+	 * udev_input_init() waits for. Input devices pick up the outputs
+	 * that exist when they are added. */
 	if (create_outputs(ec, param->connector, drm_device) < 0) {
 		weston_log("failed to create output for %s\n", path);
-		goto err_udev_input;
+		goto err_sprite;
 	}
 
 	/* A this point we have some idea of whether or not we have a working
@@ -2846,6 +3642,12 @@ drm_compositor_create(struct wl_display *display,
 	if (!ec->cursors_are_broken)
 		ec->base.capabilities |= WESTON_CAP_CURSOR_PLANE;
 
+	if (udev_input_init(&ec->input,
+			    &ec->base, ec->udev, param->seat_id) < 0) {
+		weston_log("failed to create input devices\n");
+		goto err_sprite;
+	}
+
 	path = NULL;
 
 	loop = wl_display_get_event_loop(ec->base.wl_display);
@@ -91,6 +91,13 @@ struct fbdev_output {
 	void *shadow_buf;
 	uint8_t depth;
 
+	/* Software cursor: drawn straight onto the frame buffer, and
+	 * erased by copying the shadow buffer, which never contains it,
+	 * back over cursor_box. */
+	struct weston_plane cursor_plane;
+	struct weston_view *cursor_view;
+	pixman_box32_t cursor_box;
+
 	NativeDisplayType display;
 	NativeWindowType  window;
 };
@@ -122,30 +129,214 @@ to_fbdev_compositor(struct weston_compositor *base)
 static void
 fbdev_output_start_repaint_loop(struct weston_output *output)
 {
-	uint32_t msec;
+	struct fbdev_output *fbdev_output = to_fbdev_output(output);
+	uint32_t msec, period;
 	struct timeval tv;
 
 	gettimeofday(&tv, NULL);
 	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	/* There is no vblank event to sync to, so report the last tick of
+	 * a virtual vblank clock running at the refresh rate. This keeps
+	 * the frame cadence stable for the repaint deadline. */
+	period = 1000000 / fbdev_output->mode.refresh;
+	if (output->frame_time != 0)
+		msec -= (msec - output->frame_time) % period;
+
 	weston_output_finish_frame(output, msec);
 }
 
+static void
+fbdev_output_schedule_finish_frame(struct fbdev_output *output)
+{
+	int32_t delay;
+	struct timeval tv;
+
+	/* The refresh rate is given in mHz and the interval in ms. */
+	gettimeofday(&tv, NULL);
+	delay = output->base.frame_time + 1000000 / output->mode.refresh -
+		(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+	if (delay < 1)
+		delay = 1;
+
+	wl_event_source_timer_update(output->finish_frame_timer, delay);
+}
+
+static int
+view_is_pointer_sprite(struct weston_view *ev)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &ev->surface->compositor->seat_list, link)
+		if (seat->pointer && seat->pointer->sprite == ev)
+			return 1;
+
+	return 0;
+}
+
+static void
+fbdev_output_assign_planes(struct weston_output *base)
+{
+	struct fbdev_output *output = to_fbdev_output(base);
+	struct weston_compositor *ec = base->compositor;
+	struct weston_view *ev;
+	struct weston_buffer *buffer;
+	int top = 1, cursor;
+
+	/* Only a pointer sprite on top of everything else on this output
+	 * can be the cursor. It must not be opaque either, or the views
+	 * below would be clipped out of the shadow buffer it is erased
+	 * from. Keep its buffer, so the cursor image can be read at
+	 * repaint. Views on other outputs are left to those, except for
+	 * one that left this output while on its cursor plane. */
+	output->cursor_view = NULL;
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!(ev->output_mask & (1u << base->id))) {
+			if (ev->plane == &output->cursor_plane) {
+				ev->surface->keep_buffer = 0;
+				weston_view_move_to_plane(ev,
+							  &ec->primary_plane);
+			}
+			continue;
+		}
+
+		buffer = ev->surface->buffer_ref.buffer;
+		cursor = top &&
+			 base->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+			 base->current_scale == 1 &&
+			 ev->surface->buffer_viewport.buffer.scale == 1 &&
+			 ev->output_mask == (1u << base->id) &&
+			 !ev->transform.enabled && ev->alpha == 1.0f &&
+			 buffer && wl_shm_buffer_get(buffer->resource) &&
+			 ev->surface->width <= 64 &&
+			 ev->surface->height <= 64 &&
+			 !pixman_region32_not_empty(&ev->surface->opaque) &&
+			 view_is_pointer_sprite(ev);
+
+		ev->surface->keep_buffer = cursor;
+		if (cursor) {
+			output->cursor_view = ev;
+			weston_view_move_to_plane(ev, &output->cursor_plane);
+		} else {
+			weston_view_move_to_plane(ev, &ec->primary_plane);
+		}
+
+		top = 0;
+	}
+
+	/* A repaint without damage may still be skipped as long as the
+	 * cursor neither moved nor changed, and none is left to erase. */
+	if (pixman_region32_not_empty(&output->cursor_plane.damage))
+		return;
+
+	ev = output->cursor_view;
+	if (ev)
+		base->planes_idle =
+			!pixman_region32_not_empty(&ev->surface->damage);
+	else
+		base->planes_idle =
+			output->cursor_box.x1 == output->cursor_box.x2;
+}
+
+static pixman_format_code_t
+shm_format_to_pixman(uint32_t format)
+{
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+		return PIXMAN_a8r8g8b8;
+	case WL_SHM_FORMAT_XRGB8888:
+		return PIXMAN_x8r8g8b8;
+	case WL_SHM_FORMAT_RGB565:
+		return PIXMAN_r5g6b5;
+	default:
+		return 0;
+	}
+}
+
+/* Draws the cursor view onto the frame buffer and records where, so the
+ * next repaint can erase it. */
+static void
+fbdev_output_draw_cursor(struct fbdev_output *output)
+{
+	struct weston_view *ev = output->cursor_view;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_format_code_t format;
+	pixman_image_t *image;
+	int32_t x, y;
+
+	output->cursor_box.x1 = output->cursor_box.x2 = 0;
+	output->cursor_box.y1 = output->cursor_box.y2 = 0;
+
+	pixman_region32_clear(&output->cursor_plane.damage);
+
+	if (!ev)
+		return;
+
+	shm_buffer = wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource);
+	format = shm_format_to_pixman(wl_shm_buffer_get_format(shm_buffer));
+	if (!format)
+		return;
+
+	x = ev->geometry.x - output->base.x;
+	y = ev->geometry.y - output->base.y;
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	image = pixman_image_create_bits(format,
+					 wl_shm_buffer_get_width(shm_buffer),
+					 wl_shm_buffer_get_height(shm_buffer),
+					 wl_shm_buffer_get_data(shm_buffer),
+					 wl_shm_buffer_get_stride(shm_buffer));
+	if (image) {
+		pixman_image_composite32(PIXMAN_OP_OVER,
+			image, /* src */
+			NULL /* mask */,
+			output->hw_surface, /* dest */
+			0, 0, /* src_x, src_y */
+			0, 0, /* mask_x, mask_y */
+			x, y, /* dest_x, dest_y */
+			ev->surface->width, /* width */
+			ev->surface->height /* height */);
+		pixman_image_unref(image);
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+
+	output->cursor_box.x1 = x;
+	output->cursor_box.y1 = y;
+	output->cursor_box.x2 = x + ev->surface->width;
+	output->cursor_box.y2 = y + ev->surface->height;
+}
+
 static void
 fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damage)
 {
 	struct fbdev_output *output = to_fbdev_output(base);
 	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t copy;
 	pixman_box32_t *rects;
 	int nrects, i, src_x, src_y, x1, y1, x2, y2, width, height;
 
-	/* Repaint the damaged region onto the back buffer. */
+	/* Without planes everything, the cursor too, is rendered. */
+	if (base->disable_planes)
+		output->cursor_view = NULL;
+
+	/* Repaint the damaged region onto the back buffer. Moving the
+	 * cursor leaves this empty. */
 	pixman_renderer_output_set_buffer(base, output->shadow_surface);
 	ec->renderer->repaint_output(base, damage);
 
+	/* Erase the cursor from the frame buffer along with copying the
+	 * damage, then draw it at its new place on top. */
+	pixman_region32_init_rect(&copy,
+				  output->cursor_box.x1 + base->x,
+				  output->cursor_box.y1 + base->y,
+				  output->cursor_box.x2 - output->cursor_box.x1,
+				  output->cursor_box.y2 - output->cursor_box.y1);
+	pixman_region32_union(&copy, &copy, damage);
+
 	/* Transform and composite onto the frame buffer. */
 	width = pixman_image_get_width(output->shadow_surface);
 	height = pixman_image_get_height(output->shadow_surface);
-	rects = pixman_region32_rectangles(damage, &nrects);
+	rects = pixman_region32_rectangles(&copy, &nrects);
 
 	for (i = 0; i < nrects; i++) {
 		switch (base->transform) {
@@ -188,6 +379,9 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 			x2 - x1, /* width */
 			y2 - y1 /* height */);
 	}
+	pixman_region32_fini(&copy);
+
+	fbdev_output_draw_cursor(output);
 
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
@@ -198,10 +392,8 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 	 * compositor. FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires
 	 * panning, which is broken in most kernel drivers.
 	 *
-	 * Finish the frame synchronised to the specified refresh rate. The
-	 * refresh rate is given in mHz and the interval in ms. */
-	wl_event_source_timer_update(output->finish_frame_timer,
-	                             1000000 / output->mode.refresh);
+	 * Finish the frame synchronised to the specified refresh rate. */
+	fbdev_output_schedule_finish_frame(output);
 }
 
 static int
@@ -219,8 +411,7 @@ fbdev_output_repaint(struct weston_output *base, pixman_region32_t *damage)
 		pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
 
-		wl_event_source_timer_update(output->finish_frame_timer,
-	                             1000000 / output->mode.refresh);
+		fbdev_output_schedule_finish_frame(output);
 	}
 
 	return 0;
@@ -634,6 +825,12 @@ fbdev_output_create(struct fbdev_compositor *compositor,
 	if (compositor->use_pixman) {
 		if (pixman_renderer_output_create(&output->base) < 0)
 			goto out_shadow_surface;
+
+		weston_plane_init(&output->cursor_plane,
+				  &compositor->base, 0, 0);
+		weston_compositor_stack_plane(&compositor->base,
+					      &output->cursor_plane, NULL);
+		output->base.assign_planes = fbdev_output_assign_planes;
 	} 
 	else if(compositor->use_gal2d) {
 
@@ -728,6 +925,8 @@ fbdev_output_destroy(struct weston_output *base)
 			free(output->shadow_buf);
 			output->shadow_buf = NULL;
 		}
+
+		weston_plane_release(&output->cursor_plane);
 	}
 	else if (compositor->use_gal2d) {
 		gal2d_renderer->output_destroy(base);
@@ -54,6 +54,7 @@
 #endif
 
 #include "compositor.h"
+#include "region-util.h"
 #include "scaler-server-protocol.h"
 #include "../shared/os-compatibility.h"
 #include "git-version.h"
@@ -578,6 +579,25 @@ weston_view_to_global_float(struct weston_view *view,
 	}
 }
 
+/* weston_view_to_global_float() for n x, y pairs at once, in place */
+static void
+view_to_global_points(struct weston_view *view, float *p, int n)
+{
+	int i;
+
+	if (view->transform.enabled) {
+		if (weston_matrix_transform_points(&view->transform.matrix,
+						   p, p, n) < 0)
+			weston_log("warning: numerical instability in "
+				   "%s()\n", __func__);
+	} else {
+		for (i = 0; i < n * 2; i += 2) {
+			p[i] += view->geometry.x;
+			p[i + 1] += view->geometry.y;
+		}
+	}
+}
+
 WL_EXPORT void
 weston_transformed_coord(int width, int height,
 			 enum wl_output_transform transform,
@@ -665,6 +685,7 @@ weston_transformed_region(int width, int height,
 			  pixman_region32_t *src, pixman_region32_t *dest)
 {
 	pixman_box32_t *src_rects, *dest_rects;
+	int32_t xx, xy, xo, yx, yy, yo, x1, x2, y1, y2;
 	int nrects, i;
 
 	if (transform == WL_OUTPUT_TRANSFORM_NORMAL && scale == 1) {
@@ -673,76 +694,61 @@ weston_transformed_region(int width, int height,
 		return;
 	}
 
+	/* Each transform maps x and y to plus or minus x or y, plus an
+	 * offset. Work the mapping out once, scaled, and apply it to all
+	 * the rectangles in one pass. */
+	switch (transform) {
+	default:
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+		xx = 1; xy = 0; xo = 0;
+		yx = 0; yy = 1; yo = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		xx = 0; xy = -1; xo = height;
+		yx = 1; yy = 0; yo = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		xx = -1; xy = 0; xo = width;
+		yx = 0; yy = -1; yo = height;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		xx = 0; xy = 1; xo = 0;
+		yx = -1; yy = 0; yo = width;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		xx = -1; xy = 0; xo = width;
+		yx = 0; yy = 1; yo = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		xx = 0; xy = -1; xo = height;
+		yx = -1; yy = 0; yo = width;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		xx = 1; xy = 0; xo = 0;
+		yx = 0; yy = -1; yo = height;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		xx = 0; xy = 1; xo = 0;
+		yx = 1; yy = 0; yo = 0;
+		break;
+	}
+	xx *= scale; xy *= scale; xo *= scale;
+	yx *= scale; yy *= scale; yo *= scale;
+
 	src_rects = pixman_region32_rectangles(src, &nrects);
 	dest_rects = malloc(nrects * sizeof(*dest_rects));
 	if (!dest_rects)
 		return;
 
-	if (transform == WL_OUTPUT_TRANSFORM_NORMAL) {
-		memcpy(dest_rects, src_rects, nrects * sizeof(*dest_rects));
-	} else {
-		for (i = 0; i < nrects; i++) {
-			switch (transform) {
-			default:
-			case WL_OUTPUT_TRANSFORM_NORMAL:
-				dest_rects[i].x1 = src_rects[i].x1;
-				dest_rects[i].y1 = src_rects[i].y1;
-				dest_rects[i].x2 = src_rects[i].x2;
-				dest_rects[i].y2 = src_rects[i].y2;
-				break;
-			case WL_OUTPUT_TRANSFORM_90:
-				dest_rects[i].x1 = height - src_rects[i].y2;
-				dest_rects[i].y1 = src_rects[i].x1;
-				dest_rects[i].x2 = height - src_rects[i].y1;
-				dest_rects[i].y2 = src_rects[i].x2;
-				break;
-			case WL_OUTPUT_TRANSFORM_180:
-				dest_rects[i].x1 = width - src_rects[i].x2;
-				dest_rects[i].y1 = height - src_rects[i].y2;
-				dest_rects[i].x2 = width - src_rects[i].x1;
-				dest_rects[i].y2 = height - src_rects[i].y1;
-				break;
-			case WL_OUTPUT_TRANSFORM_270:
-				dest_rects[i].x1 = src_rects[i].y1;
-				dest_rects[i].y1 = width - src_rects[i].x2;
-				dest_rects[i].x2 = src_rects[i].y2;
-				dest_rects[i].y2 = width - src_rects[i].x1;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED:
-				dest_rects[i].x1 = width - src_rects[i].x2;
-				dest_rects[i].y1 = src_rects[i].y1;
-				dest_rects[i].x2 = width - src_rects[i].x1;
-				dest_rects[i].y2 = src_rects[i].y2;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-				dest_rects[i].x1 = height - src_rects[i].y2;
-				dest_rects[i].y1 = width - src_rects[i].x2;
-				dest_rects[i].x2 = height - src_rects[i].y1;
-				dest_rects[i].y2 = width - src_rects[i].x1;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-				dest_rects[i].x1 = src_rects[i].x1;
-				dest_rects[i].y1 = height - src_rects[i].y2;
-				dest_rects[i].x2 = src_rects[i].x2;
-				dest_rects[i].y2 = height - src_rects[i].y1;
-				break;
-			case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-				dest_rects[i].x1 = src_rects[i].y1;
-				dest_rects[i].y1 = src_rects[i].x1;
-				dest_rects[i].x2 = src_rects[i].y2;
-				dest_rects[i].y2 = src_rects[i].x2;
-				break;
-			}
-		}
-	}
-
-	if (scale != 1) {
-		for (i = 0; i < nrects; i++) {
-			dest_rects[i].x1 *= scale;
-			dest_rects[i].x2 *= scale;
-			dest_rects[i].y1 *= scale;
-			dest_rects[i].y2 *= scale;
-		}
+	for (i = 0; i < nrects; i++) {
+		x1 = xx * src_rects[i].x1 + xy * src_rects[i].y1 + xo;
+		x2 = xx * src_rects[i].x2 + xy * src_rects[i].y2 + xo;
+		y1 = yx * src_rects[i].x1 + yy * src_rects[i].y1 + yo;
+		y2 = yx * src_rects[i].x2 + yy * src_rects[i].y2 + yo;
+		dest_rects[i].x1 = MIN(x1, x2);
+		dest_rects[i].x2 = x1 + x2 - dest_rects[i].x1;
+		dest_rects[i].y1 = MIN(y1, y2);
+		dest_rects[i].y2 = y1 + y2 - dest_rects[i].y1;
 	}
 
 	pixman_region32_clear(dest);
@@ -969,11 +975,11 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 {
 	float min_x = HUGE_VALF,  min_y = HUGE_VALF;
 	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
-	int32_t s[4][2] = {
-		{ sx,         sy },
-		{ sx,         sy + height },
-		{ sx + width, sy },
-		{ sx + width, sy + height }
+	float p[8] = {
+		sx,         sy,
+		sx,         sy + height,
+		sx + width, sy,
+		sx + width, sy + height
 	};
 	float int_x, int_y;
 	int i;
@@ -984,9 +990,11 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 		return;
 	}
 
-	for (i = 0; i < 4; ++i) {
-		float x, y;
-		weston_view_to_global_float(view, s[i][0], s[i][1], &x, &y);
+	view_to_global_points(view, p, 4);
+
+	for (i = 0; i < 8; i += 2) {
+		float x = p[i], y = p[i + 1];
+
 		if (x < min_x)
 			min_x = x;
 		if (x > max_x)
@@ -1315,6 +1323,55 @@ weston_surface_is_mapped(struct weston_surface *surface)
 		return 0;
 }
 
+/* The time constant of the update statistics. Updates older than a few of
+ * these no longer count. */
+#define UPDATE_DECAY_MSEC 500
+
+static float
+update_decay(struct weston_surface *surface, uint32_t now)
+{
+	return expf(-(float) (now - surface->update_stats.time) /
+		    UPDATE_DECAY_MSEC);
+}
+
+static void
+weston_surface_record_update(struct weston_surface *surface,
+			     pixman_region32_t *damage)
+{
+	uint32_t now = weston_compositor_get_time();
+	float decay = update_decay(surface, now);
+	pixman_box32_t *rects;
+	float area = 0;
+	int i, n;
+
+	rects = pixman_region32_rectangles(damage, &n);
+	for (i = 0; i < n; i++)
+		area += (float) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	surface->update_stats.updates =
+		surface->update_stats.updates * decay + 1.0f;
+	surface->update_stats.damage =
+		surface->update_stats.damage * decay + area;
+	surface->update_stats.time = now;
+}
+
+/* Returns the rate at which the surface has been getting new buffers up to
+ * now, in updates per second, and if damage_rate is not NULL the rate of
+ * damaged pixels per second. A surface updating at a steady rate converges
+ * to that rate within a second or so, and an idle one decays to zero. */
+WL_EXPORT float
+weston_surface_get_update_rate(struct weston_surface *surface, uint32_t now,
+			       float *damage_rate)
+{
+	float scale = update_decay(surface, now) * 1000.0f / UPDATE_DECAY_MSEC;
+
+	if (damage_rate)
+		*damage_rate = surface->update_stats.damage * scale;
+
+	return surface->update_stats.updates * scale;
+}
+
 static void
 surface_set_size(struct weston_surface *surface, int32_t width, int32_t height)
 {
@@ -1680,6 +1737,10 @@ weston_output_damage(struct weston_output *output)
 static void
 surface_flush_damage(struct weston_surface *surface)
 {
+	if (pixman_region32_not_empty(&surface->damage))
+		wl_signal_emit(&surface->compositor->flush_damage_signal,
+			       surface);
+
 	if (surface->buffer_ref.buffer &&
 	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource))
 		surface->compositor->renderer->flush_damage(surface);
@@ -1693,6 +1754,10 @@ view_accumulate_damage(struct weston_view *view,
 {
 	pixman_region32_t damage;
 
+	/* Most views are not damaged in a given frame. */
+	if (!pixman_region32_not_empty(&view->surface->damage))
+		goto clip;
+
 	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
@@ -1712,20 +1777,32 @@ view_accumulate_damage(struct weston_view *view,
 					  view->geometry.y - view->plane->y);
 	}
 
-	pixman_region32_subtract(&damage, &damage, opaque);
-	pixman_region32_union(&view->plane->damage,
-			      &view->plane->damage, &damage);
+	region_accumulate_damage(&view->plane->damage, &damage, opaque);
 	pixman_region32_fini(&damage);
-	pixman_region32_copy(&view->clip, opaque);
-	pixman_region32_union(opaque, opaque, &view->transform.masked_opaque);
+
+clip:
+	region_accumulate_opaque(&view->clip, opaque,
+				 &view->transform.masked_opaque);
+}
+
+static int
+weston_view_is_occluded(struct weston_view *view)
+{
+	pixman_box32_t *extents;
+
+	extents = pixman_region32_extents(&view->transform.masked_boundingbox);
+
+	return region_box_covered(&view->clip, extents);
 }
 
 static void
-compositor_accumulate_damage(struct weston_compositor *ec)
+compositor_accumulate_damage(struct weston_compositor *ec,
+			     struct weston_output *output)
 {
 	struct weston_plane *plane;
-	struct weston_view *ev;
+	struct weston_view *ev, **v;
 	pixman_region32_t opaque, clip;
+	pixman_box32_t *output_box, *bbox;
 
 	pixman_region32_init(&clip);
 
@@ -1747,6 +1824,35 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 
 	pixman_region32_fini(&clip);
 
+	/* Now that view->clip is known, find the views the renderer has
+	 * to draw on this output, bottom first, and the surfaces that
+	 * nothing of is left on screen.
+	 */
+	wl_list_for_each(ev, &ec->view_list, link)
+		ev->surface->occluded = 1;
+
+	output->visible_views.size = 0;
+	output_box = pixman_region32_extents(&output->region);
+	wl_list_for_each_reverse(ev, &ec->view_list, link) {
+		if (ev->plane != &ec->primary_plane) {
+			ev->surface->occluded = 0;
+			continue;
+		}
+
+		if (weston_view_is_occluded(ev))
+			continue;
+
+		ev->surface->occluded = 0;
+
+		bbox = pixman_region32_extents(&ev->transform.masked_boundingbox);
+		if (!box_overlaps(bbox, output_box))
+			continue;
+
+		v = wl_array_add(&output->visible_views, sizeof *v);
+		if (v)
+			*v = ev;
+	}
+
 	wl_list_for_each(ev, &ec->view_list, link)
 		ev->surface->touched = 0;
 
@@ -1755,6 +1861,14 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 			continue;
 		ev->surface->touched = 1;
 
+		/* Don't upload SHM contents nobody can see. The damage and
+		 * the buffer reference are kept until the surface shows up
+		 * again.
+		 */
+		if (ev->surface->occluded && ev->surface->buffer_ref.buffer &&
+		    wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource))
+			continue;
+
 		surface_flush_damage(ev->surface);
 
 		/* Both the renderer and the backend have seen the buffer
@@ -1894,6 +2008,87 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 			surface_free_unused_subsurface_views(view->surface);
 }
 
+/* Moves the frame callbacks due on this output to list. Must run after
+ * compositor_accumulate_damage(), which finds the occluded surfaces.
+ */
+static void
+weston_output_take_frame_callbacks(struct weston_output *output,
+				   struct wl_list *list, uint32_t msecs)
+{
+	struct weston_compositor *ec = output->compositor;
+	int32_t interval = ec->occluded_frame_interval;
+	int32_t remaining, next = 0;
+	struct weston_surface *surface;
+	struct weston_view *ev;
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		surface = ev->surface;
+
+		if (surface->output != output ||
+		    wl_list_empty(&surface->frame_callback_list))
+			continue;
+
+		if (interval != 0 && surface->occluded) {
+			if (interval < 0)
+				continue;
+
+			remaining = interval -
+				(int32_t) (msecs - surface->frame_callback_time);
+			if (remaining > 0) {
+				if (next == 0 || remaining < next)
+					next = remaining;
+				continue;
+			}
+		}
+
+		surface->frame_callback_time = msecs;
+		wl_list_insert_list(list, &surface->frame_callback_list);
+		wl_list_init(&surface->frame_callback_list);
+	}
+
+	if (next > 0)
+		wl_event_source_timer_update(output->frame_callback_timer,
+					     next);
+}
+
+static int32_t
+weston_output_refresh_period(struct weston_output *output)
+{
+	/* refresh is in mHz */
+	if (!output->current_mode || output->current_mode->refresh == 0)
+		return 16;
+
+	return 1000000 / output->current_mode->refresh;
+}
+
+static uint32_t
+weston_compositor_get_presentation_time(struct weston_compositor *compositor)
+{
+	struct timespec ts;
+
+	clock_gettime(compositor->presentation_clock, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Arms the vblank timer for the vblank after output->frame_time, in place
+ * of a page flip. Returns 0 like a backend repaint with a frame pending.
+ */
+static int
+weston_output_skip_repaint(struct weston_output *output)
+{
+	int32_t delay;
+
+	delay = output->frame_time + weston_output_refresh_period(output) -
+		weston_compositor_get_presentation_time(output->compositor);
+	if (delay < 1)
+		delay = 1;
+
+	wl_event_source_timer_update(output->vblank_timer, delay);
+
+	return 0;
+}
+
 static int
 weston_output_repaint(struct weston_output *output, uint32_t msecs)
 {
@@ -1911,25 +2106,17 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec);
 
+	output->planes_idle = 0;
 	if (output->assign_planes && !output->disable_planes)
 		output->assign_planes(output);
 	else
 		wl_list_for_each(ev, &ec->view_list, link)
 			weston_view_move_to_plane(ev, &ec->primary_plane);
 
-	wl_list_init(&frame_callback_list);
-	wl_list_for_each(ev, &ec->view_list, link) {
-		/* Note: This operation is safe to do multiple times on the
-		 * same surface.
-		 */
-		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &ev->surface->frame_callback_list);
-			wl_list_init(&ev->surface->frame_callback_list);
-		}
-	}
+	compositor_accumulate_damage(ec, output);
 
-	compositor_accumulate_damage(ec);
+	wl_list_init(&frame_callback_list);
+	weston_output_take_frame_callbacks(output, &frame_callback_list, msecs);
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -1940,7 +2127,23 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
-	r = output->repaint(output, &output_damage);
+	/* With everything on the primary plane, or the other planes
+	 * idle, no damage means the framebuffer would come out
+	 * identical, so don't render or flip and fake the vblank
+	 * instead. Frame callbacks and animations still run below, at
+	 * the refresh rate. Only the renderers emit frame_signal, so a
+	 * repaint someone waits on, like a screenshot, is never skipped.
+	 */
+	output->repaint_skipped =
+		!pixman_region32_not_empty(&output_damage) &&
+		(!output->assign_planes || output->planes_idle) &&
+		wl_list_empty(&output->frame_signal.listener_list) &&
+		output->vblank_timer;
+
+	if (output->repaint_skipped)
+		r = weston_output_skip_repaint(output);
+	else
+		r = output->repaint(output, &output_damage);
 
 	pixman_region32_fini(&output_damage);
 
@@ -1972,20 +2175,46 @@ weston_compositor_read_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
-WL_EXPORT void
-weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+static void
+weston_output_update_repaint_time(struct weston_output *output,
+				  int32_t usec)
+{
+	int32_t err;
+
+	/* Smoothed repaint time and mean deviation, as in TCP's RTT
+	 * estimator: avg += err / 8, dev += (|err| - dev) / 4.
+	 */
+	err = usec - output->repaint_avg_usec;
+	output->repaint_avg_usec += err / 8;
+	if (err < 0)
+		err = -err;
+	output->repaint_dev_usec += (err - output->repaint_dev_usec) / 4;
+}
+
+static void
+weston_output_maybe_repaint(struct weston_output *output, uint32_t msecs)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(compositor->wl_display);
+	struct timespec start, end;
+	static int first_frame = 1;
 	int fd, r;
 
-	output->frame_time = msecs;
-
 	if (output->repaint_needed &&
 	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
 	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		r = weston_output_repaint(output, msecs);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (!output->repaint_skipped)
+			weston_output_update_repaint_time(output,
+				(end.tv_sec - start.tv_sec) * 1000000 +
+				(end.tv_nsec - start.tv_nsec) / 1000);
+		if (first_frame && r == 0 && !output->repaint_skipped) {
+			weston_log_startup("first frame");
+			first_frame = 0;
+		}
 		if (!r)
 			return;
 	}
@@ -2000,6 +2229,88 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 				     weston_compositor_read_input, compositor);
 }
 
+static int
+output_repaint_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_maybe_repaint(output, output->frame_time);
+
+	return 0;
+}
+
+static int
+output_frame_callback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_schedule_repaint(output);
+
+	return 0;
+}
+
+static int
+output_vblank_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_finish_frame(output, output->frame_time +
+				   weston_output_refresh_period(output));
+
+	return 0;
+}
+
+/* Returns how many ms to wait after the vblank at msecs before starting
+ * the next repaint, so that it completes just before the following
+ * vblank. Anything less than 1 means repaint right away.
+ */
+static int32_t
+weston_output_repaint_delay(struct weston_output *output, uint32_t msecs)
+{
+	int32_t period, window, predicted;
+
+	if (output->repaint_window <= 0 || !output->repaint_timer ||
+	    !output->current_mode || output->current_mode->refresh == 0)
+		return 0;
+
+	period = weston_output_refresh_period(output);
+
+	window = output->repaint_window;
+	predicted = (output->repaint_avg_usec +
+		     4 * output->repaint_dev_usec + 999) / 1000;
+	if (predicted > window)
+		window = predicted;
+	if (window >= period)
+		return 0;
+
+	return (int32_t) (msecs + period - window -
+			  weston_compositor_get_presentation_time(
+				  output->compositor));
+}
+
+WL_EXPORT void
+weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
+{
+	int32_t delay;
+
+	output->frame_time = msecs;
+
+	delay = weston_output_repaint_delay(output, msecs);
+	if (delay > 0) {
+		wl_event_source_timer_update(output->repaint_timer, delay);
+		return;
+	}
+
+	weston_output_maybe_repaint(output, msecs);
+}
+
+WL_EXPORT void
+weston_compositor_set_presentation_clock(struct weston_compositor *compositor,
+					 clockid_t clk_id)
+{
+	compositor->presentation_clock = clk_id;
+}
+
 static void
 idle_repaint(void *data)
 {
@@ -2029,6 +2340,7 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 {
 	wl_list_init(&layer->view_list.link);
 	layer->view_list.layer = layer;
+	layer->is_static = 0;
 	weston_layer_set_mask_infinite(layer);
 	if (below != NULL)
 		wl_list_insert(below, &layer->link);
@@ -2222,6 +2534,7 @@ weston_surface_commit_state(struct weston_surface *surface,
 {
 	struct weston_view *view;
 	pixman_region32_t opaque;
+	int newly_attached = state->newly_attached;
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
@@ -2245,6 +2558,12 @@ weston_surface_commit_state(struct weston_surface *surface,
 	state->buffer_viewport.changed = 0;
 
 	/* wl_surface.damage */
+	if (newly_attached && surface->buffer_ref.buffer) {
+		pixman_region32_intersect_rect(&state->damage, &state->damage,
+					       0, 0, surface->width,
+					       surface->height);
+		weston_surface_record_update(surface, &state->damage);
+	}
 	pixman_region32_union(&surface->damage, &surface->damage,
 			      &state->damage);
 	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
@@ -3258,6 +3577,14 @@ weston_output_destroy(struct weston_output *output)
 	wl_signal_emit(&output->compositor->output_destroyed_signal, output);
 	wl_signal_emit(&output->destroy_signal, output);
 
+	if (output->repaint_timer)
+		wl_event_source_remove(output->repaint_timer);
+	if (output->frame_callback_timer)
+		wl_event_source_remove(output->frame_callback_timer);
+	if (output->vblank_timer)
+		wl_event_source_remove(output->vblank_timer);
+	wl_array_release(&output->visible_views);
+
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
@@ -3442,6 +3769,9 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 		   int x, int y, int mm_width, int mm_height, uint32_t transform,
 		   int32_t scale)
 {
+	struct wl_event_loop *loop = wl_display_get_event_loop(c->wl_display);
+	struct weston_config_section *section;
+
 	output->compositor = c;
 	output->x = x;
 	output->y = y;
@@ -3460,6 +3790,28 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
+	wl_array_init(&output->visible_views);
+
+	section = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "repaint-window",
+				      &output->repaint_window, 0);
+	if (output->name) {
+		section = weston_config_get_section(c->config, "output",
+						    "name", output->name);
+		weston_config_section_get_int(section, "repaint-window",
+					      &output->repaint_window,
+					      output->repaint_window);
+	}
+	output->repaint_timer =
+		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
+					output);
+	output->frame_callback_timer =
+		wl_event_loop_add_timer(loop,
+					output_frame_callback_timer_handler,
+					output);
+	output->vblank_timer =
+		wl_event_loop_add_timer(loop, output_vblank_timer_handler,
+					output);
 
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
@@ -3803,6 +4155,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_signal_init(&ec->create_surface_signal);
 	wl_signal_init(&ec->activate_signal);
 	wl_signal_init(&ec->transform_signal);
+	wl_signal_init(&ec->flush_damage_signal);
 	wl_signal_init(&ec->kill_signal);
 	wl_signal_init(&ec->idle_signal);
 	wl_signal_init(&ec->wake_signal);
@@ -3817,6 +4170,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	ec->session_active = 1;
 
 	ec->output_id_pool = 0;
+	ec->presentation_clock = CLOCK_REALTIME;
 
 	if (!wl_global_create(display, &wl_compositor_interface, 3,
 			      ec, compositor_bind))
@@ -4381,6 +4735,7 @@ int main(int argc, char *argv[])
 		   STAMP_SPACE "Build: %s\n",
 		   PACKAGE_STRING, PACKAGE_URL, PACKAGE_BUGREPORT,
 		   BUILD_ID);
+	weston_log_startup("start");
 	log_uname();
 
 	verify_xdg_runtime_dir();
@@ -4413,6 +4768,7 @@ int main(int argc, char *argv[])
 		weston_log("Starting with no config file.\n");
 	}
 	section = weston_config_get_section(config, "core", NULL, NULL);
+	weston_log_startup("config parsed");
 
 	if (!backend) {
 		weston_config_section_get_string(section, "backend", &backend,
@@ -4427,12 +4783,15 @@ int main(int argc, char *argv[])
 		goto out_signals;
 	}
 
+	weston_log_startup("backend loaded");
+
 	ec = backend_init(display, &argc, argv, config);
 	if (ec == NULL) {
 		weston_log("fatal: failed to create compositor\n");
 		ret = EXIT_FAILURE;
 		goto out_signals;
 	}
+	weston_log_startup("outputs and input initialized");
 
 	catch_signals();
 	segv_compositor = ec;
@@ -4481,6 +4840,7 @@ int main(int argc, char *argv[])
 
 	if (load_modules(ec, shell, &argc, argv) < 0)
 		goto out;
+	weston_log_startup("shell loaded");
 
 	weston_config_section_get_string(section, "modules", &modules, "");
 	if (load_modules(ec, modules, &argc, argv) < 0)
@@ -4488,6 +4848,7 @@ int main(int argc, char *argv[])
 
 	if (load_modules(ec, option_modules, &argc, argv) < 0)
 		goto out;
+	weston_log_startup("modules loaded");
 
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_bool(section, "numlock-on", &numlock_on, 0);
@@ -4502,6 +4863,7 @@ int main(int argc, char *argv[])
 
 	weston_compositor_wake(ec);
 
+	weston_log_startup("running");
 	wl_display_run(display);
 
 out:
@@ -28,6 +28,7 @@
 extern "C" {
 #endif
 
+#include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
 
@@ -203,6 +204,32 @@ struct weston_output {
 	int move_x, move_y;
 	uint32_t frame_time;
 	int disable_planes;
+
+	/* Repaint deadline: start repainting this many ms before the
+	 * predicted vblank instead of right after the previous one.
+	 * 0 disables the deadline. The window is widened automatically
+	 * when the measured repaint time does not fit in it.
+	 */
+	int32_t repaint_window;
+	int32_t repaint_avg_usec, repaint_dev_usec;
+	struct wl_event_source *repaint_timer;
+
+	/* Wakes up the repaint loop for throttled frame callbacks */
+	struct wl_event_source *frame_callback_timer;
+
+	/* Stands in for the page flip when a repaint had no damage */
+	struct wl_event_source *vblank_timer;
+	int repaint_skipped;
+	/* Set by assign_planes when nothing it put on other planes
+	 * needs the output repainted, so that a repaint without
+	 * damage can still be skipped */
+	int planes_idle;
+
+	/* struct weston_view *: the primary plane views on this output
+	 * that are not fully covered by opaque views, bottom first.
+	 * Rebuilt on every repaint, valid only while repainting.
+	 */
+	struct wl_array visible_views;
 	int destroying;
 
 	char *make, *model, *serial_number;
@@ -546,6 +573,8 @@ struct weston_layer {
 	struct weston_layer_entry view_list;
 	struct wl_list link;
 	pixman_box32_t mask;
+	/* The views rarely change, so renderers may cache them composited */
+	int is_static;
 };
 
 struct weston_plane {
@@ -596,6 +625,8 @@ struct weston_compositor {
 	struct wl_signal create_surface_signal;
 	struct wl_signal activate_signal;
 	struct wl_signal transform_signal;
+	/* Emitted with a surface before its damage is flushed */
+	struct wl_signal flush_damage_signal;
 
 	struct wl_signal kill_signal;
 	struct wl_signal idle_signal;
@@ -646,6 +677,16 @@ struct weston_compositor {
 
 	pixman_format_code_t read_format;
 
+	/* Clock the backend's frame timestamps are taken from */
+	clockid_t presentation_clock;
+
+	/* Frame callbacks of surfaces whose views are all covered by
+	 * opaque views are sent at most every occluded_frame_interval ms.
+	 * 0 sends them every frame, a negative value holds them until the
+	 * surface becomes visible again. Set by the shell.
+	 */
+	int32_t occluded_frame_interval;
+
 	void (*destroy)(struct weston_compositor *ec);
 	void (*restore)(struct weston_compositor *ec);
 	int (*authenticate)(struct weston_compositor *c, uint32_t id);
@@ -657,6 +698,8 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	/* The global keymap being compiled on a thread */
+	struct weston_xkb_build *xkb_build;
 
 	/* Raw keyboard processing (no libxkbcommon initialization or handling) */
 	int use_xkbcommon;
@@ -853,6 +896,11 @@ struct weston_surface {
 	 */
 	int32_t touched;
 
+	/* Set during repaint when no view of the surface is left visible
+	 * after clip subtraction.
+	 */
+	int occluded;
+
 	void *renderer_state;
 
 	struct wl_list views;
@@ -871,6 +919,16 @@ struct weston_surface {
 	uint32_t output_mask;
 
 	struct wl_list frame_callback_list;
+	uint32_t frame_callback_time; /* when callbacks were last sent */
+
+	/* Exponentially decayed counts of the commits that attached a
+	 * buffer and of the pixels they damaged, as of 'time'. See
+	 * weston_surface_get_update_rate(). */
+	struct {
+		uint32_t time;
+		float updates;
+		float damage;
+	} update_stats;
 
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
@@ -1048,6 +1106,9 @@ weston_compositor_stack_plane(struct weston_compositor *ec,
 void
 weston_output_finish_frame(struct weston_output *output, uint32_t msecs);
 void
+weston_compositor_set_presentation_clock(struct weston_compositor *compositor,
+					 clockid_t clk_id);
+void
 weston_output_schedule_repaint(struct weston_output *output);
 void
 weston_output_damage(struct weston_output *output);
@@ -1196,6 +1257,10 @@ weston_view_schedule_repaint(struct weston_view *view);
 int
 weston_surface_is_mapped(struct weston_surface *surface);
 
+float
+weston_surface_get_update_rate(struct weston_surface *surface, uint32_t now,
+			       float *damage_rate);
+
 WL_EXPORT void
 weston_surface_set_size(struct weston_surface *surface,
 			int32_t width, int32_t height);
@@ -1301,6 +1366,8 @@ weston_log(const char *fmt, ...)
 int
 weston_log_continue(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
+void
+weston_log_startup(const char *phase);
 
 enum {
 	TTY_ENTER_VT,
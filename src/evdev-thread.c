@@ -0,0 +1,454 @@
+/*
+ * Copyright © 2010 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "compositor.h"
+#include "evdev.h"
+#include "evdev-thread.h"
+
+/* A power of two, so that the free running indices wrap cleanly. */
+#define EVDEV_THREAD_QUEUE_SIZE 1024
+
+struct evdev_thread {
+	struct weston_compositor *compositor;
+	struct wl_event_loop *loop;
+	struct wl_event_source *wake_source;
+	int wake_fd;	/* input thread -> main thread */
+	int quit_fd;	/* main thread -> input thread */
+	pthread_t thread;
+
+	/* Held only to hand the devices between the threads: the input
+	 * thread dispatches them while dispatching is set, the main thread
+	 * owns them while locked is set. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int dispatching;
+	int locked;
+	int waiting;	/* the input thread waits for room in the queue */
+
+	struct evdev_thread_event queue[EVDEV_THREAD_QUEUE_SIZE];
+	uint32_t head;	/* written by the main thread only */
+	uint32_t tail;	/* written by the input thread only */
+	int pushed;
+
+	/* Written by the main thread, while locked */
+	int cursor_active;
+	struct evdev_thread_cursor cursor;
+	uint32_t base_x, base_y;
+
+	/* Input thread, while dispatching */
+	uint32_t produced_x, produced_y;
+	int32_t cursor_x, cursor_y;
+
+	/* Main thread */
+	uint32_t consumed_x, consumed_y;
+};
+
+static void
+evdev_thread_wake(struct evdev_thread *thread)
+{
+	uint64_t one = 1;
+
+	if (write(thread->wake_fd, &one, sizeof one) < 0 && errno != EAGAIN)
+		weston_log("failed to wake up main thread: %m\n");
+}
+
+static int
+evdev_thread_queue_full(struct evdev_thread *thread)
+{
+	return __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&thread->head, __ATOMIC_ACQUIRE) ==
+		EVDEV_THREAD_QUEUE_SIZE;
+}
+
+void
+evdev_thread_push(struct evdev_thread *thread,
+		  struct evdev_thread_event *event)
+{
+	uint32_t tail = thread->tail;
+
+	event->has_total = 0;
+	if (event->type == EVDEV_THREAD_MOTION && thread->cursor_active &&
+	    event->seat == thread->cursor.seat) {
+		thread->produced_x += event->a;
+		thread->produced_y += event->b;
+		event->total_x = thread->produced_x;
+		event->total_y = thread->produced_y;
+		event->has_total = 1;
+	} else if (event->type == EVDEV_THREAD_MOTION_ABSOLUTE &&
+		   event->seat == thread->cursor.seat) {
+		/* Leave the cursor alone until the main thread has seen
+		 * where it went. */
+		thread->cursor_active = 0;
+	}
+
+	if (evdev_thread_queue_full(thread)) {
+		pthread_mutex_lock(&thread->mutex);
+		thread->waiting = 1;
+		pthread_cond_broadcast(&thread->cond);
+		while (evdev_thread_queue_full(thread)) {
+			evdev_thread_wake(thread);
+			pthread_cond_wait(&thread->cond, &thread->mutex);
+		}
+		thread->waiting = 0;
+		pthread_mutex_unlock(&thread->mutex);
+	}
+
+	thread->queue[tail % EVDEV_THREAD_QUEUE_SIZE] = *event;
+	__atomic_store_n(&thread->tail, tail + 1, __ATOMIC_RELEASE);
+	thread->pushed = 1;
+}
+
+static void
+evdev_thread_notify(struct evdev_thread *thread,
+		    struct evdev_thread_event *e)
+{
+	switch (e->type) {
+	case EVDEV_THREAD_MOTION:
+		if (e->has_total) {
+			thread->consumed_x = e->total_x;
+			thread->consumed_y = e->total_y;
+		}
+		notify_motion(e->seat, e->time, e->a, e->b);
+		break;
+	case EVDEV_THREAD_MOTION_ABSOLUTE:
+		evdev_device_notify_motion_absolute(e->device, e->time,
+						    e->a, e->b);
+		break;
+	case EVDEV_THREAD_BUTTON:
+		notify_button(e->seat, e->time, e->a, e->b);
+		break;
+	case EVDEV_THREAD_KEY:
+		notify_key(e->seat, e->time, e->a, e->b,
+			   STATE_UPDATE_AUTOMATIC);
+		break;
+	case EVDEV_THREAD_AXIS:
+		notify_axis(e->seat, e->time, e->a, e->b);
+		break;
+	case EVDEV_THREAD_TOUCH:
+		evdev_device_notify_touch(e->device, e->time,
+					  e->a, e->b, e->c, e->d);
+		break;
+	case EVDEV_THREAD_TOUCH_FRAME:
+		notify_touch_frame(e->seat);
+		break;
+	}
+}
+
+/* Runs the queued events on the main thread. Each event is taken off the
+ * queue before it runs, so that this can be re-entered from a notify
+ * handler that ends up destroying a device. */
+void
+evdev_thread_flush(struct evdev_thread *thread)
+{
+	struct evdev_thread_event event;
+	uint32_t head;
+	int flushed = 0;
+
+	while ((head = thread->head) !=
+	       __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE)) {
+		event = thread->queue[head % EVDEV_THREAD_QUEUE_SIZE];
+		__atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+		evdev_thread_notify(thread, &event);
+		flushed = 1;
+	}
+
+	if (flushed) {
+		pthread_mutex_lock(&thread->mutex);
+		if (thread->waiting)
+			pthread_cond_broadcast(&thread->cond);
+		pthread_mutex_unlock(&thread->mutex);
+	}
+}
+
+static int
+evdev_thread_wake_handler(int fd, uint32_t mask, void *data)
+{
+	struct evdev_thread *thread = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("failed to read input thread wakeup: %m\n");
+
+	evdev_thread_flush(thread);
+
+	return 1;
+}
+
+static void
+evdev_thread_cursor_position(struct evdev_thread *thread,
+			     int32_t *x, int32_t *y)
+{
+	struct evdev_thread_cursor *cursor = &thread->cursor;
+
+	*x = wl_fixed_to_int(cursor->x +
+			     (int32_t) (thread->produced_x - thread->base_x));
+	*y = wl_fixed_to_int(cursor->y +
+			     (int32_t) (thread->produced_y - thread->base_y));
+}
+
+static void
+evdev_thread_cursor_move_to(struct evdev_thread *thread, int32_t x, int32_t y)
+{
+	struct evdev_thread_cursor *cursor = &thread->cursor;
+
+	x = (x - cursor->hotspot_x - cursor->area.x1) * cursor->scale;
+	y = (y - cursor->hotspot_y - cursor->area.y1) * cursor->scale;
+	if (x == thread->cursor_x && y == thread->cursor_y)
+		return;
+
+	cursor->move(cursor->data, x, y);
+	thread->cursor_x = x;
+	thread->cursor_y = y;
+}
+
+/* Returns -1 if the motion took the cursor off the area, where the main
+ * thread has to deal with it. */
+static int
+evdev_thread_move_cursor(struct evdev_thread *thread)
+{
+	struct evdev_thread_cursor *cursor = &thread->cursor;
+	int32_t x, y;
+
+	if (!thread->cursor_active)
+		return 0;
+
+	evdev_thread_cursor_position(thread, &x, &y);
+	if (x < cursor->area.x1 || x >= cursor->area.x2 ||
+	    y < cursor->area.y1 || y >= cursor->area.y2)
+		return -1;
+
+	evdev_thread_cursor_move_to(thread, x, y);
+
+	return 0;
+}
+
+static void *
+evdev_thread_run(void *data)
+{
+	struct evdev_thread *thread = data;
+	struct pollfd fds[2];
+	int pushed;
+
+	fds[0].fd = wl_event_loop_get_fd(thread->loop);
+	fds[0].events = POLLIN;
+	fds[1].fd = thread->quit_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			weston_log("input thread: poll failed: %m\n");
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		pthread_mutex_lock(&thread->mutex);
+		while (thread->locked)
+			pthread_cond_wait(&thread->cond, &thread->mutex);
+		thread->dispatching = 1;
+		pthread_mutex_unlock(&thread->mutex);
+
+		thread->pushed = 0;
+		wl_event_loop_dispatch(thread->loop, 0);
+		evdev_thread_move_cursor(thread);
+		pushed = thread->pushed;
+
+		pthread_mutex_lock(&thread->mutex);
+		thread->dispatching = 0;
+		pthread_cond_broadcast(&thread->cond);
+		pthread_mutex_unlock(&thread->mutex);
+
+		if (pushed)
+			evdev_thread_wake(thread);
+	}
+
+	return NULL;
+}
+
+struct wl_event_loop *
+evdev_thread_get_loop(struct evdev_thread *thread)
+{
+	return thread->loop;
+}
+
+/* For the main thread. Waits for the dispatch in progress to finish.
+ * The input thread may be waiting for room in the queue in the middle of
+ * it, so drain the queue if it fills up meanwhile. */
+void
+evdev_thread_lock(struct evdev_thread *thread)
+{
+	pthread_mutex_lock(&thread->mutex);
+	while (thread->dispatching) {
+		if (thread->waiting && evdev_thread_queue_full(thread)) {
+			pthread_mutex_unlock(&thread->mutex);
+			evdev_thread_flush(thread);
+			pthread_mutex_lock(&thread->mutex);
+			continue;
+		}
+		pthread_cond_wait(&thread->cond, &thread->mutex);
+	}
+	thread->locked = 1;
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+void
+evdev_thread_unlock(struct evdev_thread *thread)
+{
+	pthread_mutex_lock(&thread->mutex);
+	thread->locked = 0;
+	pthread_cond_broadcast(&thread->cond);
+	pthread_mutex_unlock(&thread->mutex);
+}
+
+/* Publishes the cursor position the main thread has drawn, and moves the
+ * cursor there plus whatever motion the main thread has not seen yet, so
+ * that it never jumps back. */
+void
+evdev_thread_set_cursor(struct evdev_thread *thread,
+			const struct evdev_thread_cursor *cursor)
+{
+	evdev_thread_lock(thread);
+
+	if (!thread->cursor_active || thread->cursor.data != cursor->data) {
+		thread->cursor_x = INT32_MIN;
+		thread->cursor_y = INT32_MIN;
+	}
+
+	thread->cursor = *cursor;
+	thread->cursor_active = 1;
+	thread->base_x = thread->consumed_x;
+	thread->base_y = thread->consumed_y;
+
+	if (evdev_thread_move_cursor(thread) < 0)
+		evdev_thread_cursor_move_to(thread,
+					    wl_fixed_to_int(cursor->x),
+					    wl_fixed_to_int(cursor->y));
+
+	evdev_thread_unlock(thread);
+}
+
+void
+evdev_thread_clear_cursor(struct evdev_thread *thread, void *data)
+{
+	evdev_thread_lock(thread);
+	if (thread->cursor_active && thread->cursor.data == data)
+		thread->cursor_active = 0;
+	evdev_thread_unlock(thread);
+}
+
+struct evdev_thread *
+evdev_thread_create(struct weston_compositor *compositor)
+{
+	struct evdev_thread *thread;
+	struct wl_event_loop *loop;
+	sigset_t all, saved;
+	int ret;
+
+	thread = zalloc(sizeof *thread);
+	if (thread == NULL)
+		return NULL;
+
+	thread->compositor = compositor;
+	thread->wake_fd = -1;
+	thread->quit_fd = -1;
+	pthread_mutex_init(&thread->mutex, NULL);
+	pthread_cond_init(&thread->cond, NULL);
+
+	thread->loop = wl_event_loop_create();
+	if (thread->loop == NULL)
+		goto err;
+
+	thread->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (thread->wake_fd < 0 || thread->quit_fd < 0)
+		goto err;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	thread->wake_source =
+		wl_event_loop_add_fd(loop, thread->wake_fd, WL_EVENT_READABLE,
+				     evdev_thread_wake_handler, thread);
+	if (thread->wake_source == NULL)
+		goto err;
+
+	/* Signals are for the main thread's signalfds. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+	ret = pthread_create(&thread->thread, NULL, evdev_thread_run, thread);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (ret != 0) {
+		weston_log("failed to create input thread\n");
+		goto err;
+	}
+
+	weston_log("reading input devices on a separate thread\n");
+
+	return thread;
+
+err:
+	if (thread->wake_source)
+		wl_event_source_remove(thread->wake_source);
+	if (thread->wake_fd >= 0)
+		close(thread->wake_fd);
+	if (thread->quit_fd >= 0)
+		close(thread->quit_fd);
+	if (thread->loop)
+		wl_event_loop_destroy(thread->loop);
+	pthread_cond_destroy(&thread->cond);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+	return NULL;
+}
+
+/* All devices of the thread must have been destroyed. */
+void
+evdev_thread_destroy(struct evdev_thread *thread)
+{
+	uint64_t one = 1;
+
+	if (write(thread->quit_fd, &one, sizeof one) < 0)
+		weston_log("failed to stop input thread: %m\n");
+	pthread_join(thread->thread, NULL);
+
+	evdev_thread_flush(thread);
+
+	wl_event_source_remove(thread->wake_source);
+	close(thread->wake_fd);
+	close(thread->quit_fd);
+	wl_event_loop_destroy(thread->loop);
+	pthread_cond_destroy(&thread->cond);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+}
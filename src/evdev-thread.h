@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2011, 2012 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef EVDEV_THREAD_H
+#define EVDEV_THREAD_H
+
+#include "config.h"
+
+#include "compositor.h"
+
+/* The input thread reads and processes evdev devices off the main loop.
+ * Devices created with a thread have their fd and timer sources on the
+ * thread's event loop, which only the thread dispatches. The main thread
+ * takes the thread lock to add or remove sources or to change device
+ * state the thread reads; it waits for a dispatch in progress to finish,
+ * and the thread does not dispatch while the lock is held.
+ *
+ * The notify_*() calls the devices make are queued as events in a single
+ * producer, single consumer ring and run on the main thread. The thread
+ * reads no output state: absolute and touch events are queued with raw
+ * axis values and mapped to the output when they run.
+ */
+
+struct evdev_device;
+
+enum evdev_thread_event_type {
+	EVDEV_THREAD_MOTION,
+	EVDEV_THREAD_MOTION_ABSOLUTE,
+	EVDEV_THREAD_BUTTON,
+	EVDEV_THREAD_KEY,
+	EVDEV_THREAD_AXIS,
+	EVDEV_THREAD_TOUCH,
+	EVDEV_THREAD_TOUCH_FRAME,
+};
+
+struct evdev_thread_event {
+	uint32_t type;
+	uint32_t time;
+	struct weston_seat *seat;
+	struct evdev_device *device;
+	int32_t a, b, c, d;
+	/* Set by evdev_thread_push() for motion of the cursor seat: the
+	 * running motion sum, including this event */
+	int has_total;
+	uint32_t total_x, total_y;
+};
+
+/* Where the main thread last drew a cursor on a hardware cursor plane,
+ * and the output area it may move on. The thread keeps a copy taken
+ * under the lock. The cursor is moved by the relative motion queued
+ * since, by calling move() with the position of the cursor image on the
+ * output, from either thread but never both at once. */
+struct evdev_thread_cursor {
+	struct weston_seat *seat;
+	wl_fixed_t x, y;
+	int32_t hotspot_x, hotspot_y;
+	int32_t scale;
+	pixman_box32_t area;
+	void (*move)(void *data, int32_t x, int32_t y);
+	void *data;
+};
+
+struct evdev_thread;
+
+struct evdev_thread *
+evdev_thread_create(struct weston_compositor *compositor);
+
+void
+evdev_thread_destroy(struct evdev_thread *thread);
+
+struct wl_event_loop *
+evdev_thread_get_loop(struct evdev_thread *thread);
+
+void
+evdev_thread_lock(struct evdev_thread *thread);
+
+void
+evdev_thread_unlock(struct evdev_thread *thread);
+
+void
+evdev_thread_push(struct evdev_thread *thread,
+		  struct evdev_thread_event *event);
+
+void
+evdev_thread_flush(struct evdev_thread *thread);
+
+void
+evdev_thread_set_cursor(struct evdev_thread *thread,
+			const struct evdev_thread_cursor *cursor);
+
+void
+evdev_thread_clear_cursor(struct evdev_thread *thread, void *data);
+
+#endif /* EVDEV_THREAD_H */
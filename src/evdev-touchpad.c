@@ -31,6 +31,7 @@
 
 #include "filter.h"
 #include "evdev.h"
+#include "evdev-thread.h"
 #include "../shared/config-parser.h"
 
 /* Default values */
@@ -160,16 +161,13 @@ struct touchpad_dispatch {
 static enum touchpad_model
 get_touchpad_model(struct evdev_device *device)
 {
-	struct input_id id;
+	struct input_id *id = &device->caps.id;
 	unsigned int i;
 
-	if (ioctl(device->fd, EVIOCGID, &id) < 0)
-		return TOUCHPAD_MODEL_UNKNOWN;
-
 	for (i = 0; i < ARRAY_LENGTH(touchpad_spec_table); i++)
-		if (touchpad_spec_table[i].vendor == id.vendor &&
+		if (touchpad_spec_table[i].vendor == id->vendor &&
 		    (!touchpad_spec_table[i].product ||
-		     touchpad_spec_table[i].product == id.product))
+		     touchpad_spec_table[i].product == id->product))
 			return touchpad_spec_table[i].model;
 
 	return TOUCHPAD_MODEL_UNKNOWN;
@@ -201,7 +199,7 @@ static double
 touchpad_profile(struct weston_motion_filter *filter,
 		 void *data,
 		 double velocity,
-		 uint32_t time)
+		 uint64_t time)
 {
 	struct touchpad_dispatch *touchpad =
 		(struct touchpad_dispatch *) data;
@@ -263,14 +261,14 @@ touchpad_get_delta(struct touchpad_dispatch *touchpad, double *dx, double *dy)
 
 static void
 filter_motion(struct touchpad_dispatch *touchpad,
-	      double *dx, double *dy, uint32_t time)
+	      double *dx, double *dy, uint64_t time_usec)
 {
 	struct weston_motion_params motion;
 
 	motion.dx = *dx;
 	motion.dy = *dy;
 
-	weston_filter_dispatch(touchpad->filter, &motion, touchpad, time);
+	weston_filter_dispatch(touchpad->filter, &motion, touchpad, time_usec);
 
 	*dx = motion.dx;
 	*dy = motion.dy;
@@ -279,17 +277,17 @@ filter_motion(struct touchpad_dispatch *touchpad,
 static void
 notify_button_pressed(struct touchpad_dispatch *touchpad, uint32_t time)
 {
-	notify_button(touchpad->device->seat, time,
-		      DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-		      WL_POINTER_BUTTON_STATE_PRESSED);
+	evdev_notify_button(touchpad->device, time,
+			    DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
+			    WL_POINTER_BUTTON_STATE_PRESSED);
 }
 
 static void
 notify_button_released(struct touchpad_dispatch *touchpad, uint32_t time)
 {
-	notify_button(touchpad->device->seat, time,
-		      DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
-		      WL_POINTER_BUTTON_STATE_RELEASED);
+	evdev_notify_button(touchpad->device, time,
+			    DEFAULT_TOUCHPAD_SINGLE_TAP_BUTTON,
+			    WL_POINTER_BUTTON_STATE_RELEASED);
 }
 
 static void
@@ -424,7 +422,8 @@ fsm_timout_handler(void *data)
 }
 
 static void
-touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
+touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time,
+		      uint64_t time_usec)
 {
 	int motion_index;
 	int center_x, center_y;
@@ -487,23 +486,23 @@ touchpad_update_state(struct touchpad_dispatch *touchpad, uint32_t time)
 	if (touchpad->motion_count >= 4) {
 		touchpad_get_delta(touchpad, &dx, &dy);
 
-		filter_motion(touchpad, &dx, &dy, time);
+		filter_motion(touchpad, &dx, &dy, time_usec);
 
 		if (touchpad->finger_state == TOUCHPAD_FINGERS_ONE) {
-			notify_motion(touchpad->device->seat, time,
-				      wl_fixed_from_double(dx),
-				      wl_fixed_from_double(dy));
+			evdev_notify_motion(touchpad->device, time,
+					    wl_fixed_from_double(dx),
+					    wl_fixed_from_double(dy));
 		} else if (touchpad->finger_state == TOUCHPAD_FINGERS_TWO) {
 			if (dx != 0.0)
-				notify_axis(touchpad->device->seat,
-					    time,
-					    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
-					    wl_fixed_from_double(dx));
+				evdev_notify_axis(touchpad->device,
+						  time,
+						  WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+						  wl_fixed_from_double(dx));
 			if (dy != 0.0)
-				notify_axis(touchpad->device->seat,
-					    time,
-					    WL_POINTER_AXIS_VERTICAL_SCROLL,
-					    wl_fixed_from_double(dy));
+				evdev_notify_axis(touchpad->device,
+						  time,
+						  WL_POINTER_AXIS_VERTICAL_SCROLL,
+						  wl_fixed_from_double(dy));
 		}
 	}
 
@@ -596,9 +595,9 @@ process_key(struct touchpad_dispatch *touchpad,
 			code = BTN_RIGHT;
 		else
 			code = e->code;
-		notify_button(device->seat, time, code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-			                 WL_POINTER_BUTTON_STATE_RELEASED);
+		evdev_notify_button(device, time, code,
+				    e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					       WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 	case BTN_TOOL_PEN:
 	case BTN_TOOL_RUBBER:
@@ -652,7 +651,7 @@ touchpad_process(struct evdev_dispatch *dispatch,
 		break;
 	}
 
-	touchpad_update_state(touchpad, time);
+	touchpad_update_state(touchpad, time, evdev_event_time_usec(e));
 }
 
 static void
@@ -706,9 +705,8 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	struct weston_motion_filter *accel;
 	struct wl_event_loop *loop;
 
-	unsigned long prop_bits[INPUT_PROP_MAX];
-	struct input_absinfo absinfo;
-	unsigned long abs_bits[NBITS(ABS_MAX)];
+	struct evdev_device_caps *caps = &device->caps;
+	struct input_absinfo *absinfo;
 
 	bool has_buttonpad;
 
@@ -722,16 +720,14 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	/* Detect model */
 	touchpad->model = get_touchpad_model(device);
 
-	ioctl(device->fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits);
-	has_buttonpad = TEST_BIT(prop_bits, INPUT_PROP_BUTTONPAD);
+	has_buttonpad = TEST_BIT(caps->prop_bits, INPUT_PROP_BUTTONPAD);
 
 	/* Configure pressure */
-	ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
-	if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
-		ioctl(device->fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
+	if (TEST_BIT(caps->abs_bits, ABS_PRESSURE)) {
+		absinfo = &caps->absinfo[ABS_PRESSURE];
 		configure_touchpad_pressure(touchpad,
-					    absinfo.minimum,
-					    absinfo.maximum);
+					    absinfo->minimum,
+					    absinfo->maximum);
 	}
 
 	/* Configure acceleration factor */
@@ -768,7 +764,12 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	wl_array_init(&touchpad->fsm.events);
 	touchpad->fsm.state = FSM_IDLE;
 
-	loop = wl_display_get_event_loop(device->seat->compositor->wl_display);
+	/* The timer sends taps, from the thread reading the device. */
+	if (device->thread)
+		loop = evdev_thread_get_loop(device->thread);
+	else
+		loop = wl_display_get_event_loop(
+			device->seat->compositor->wl_display);
 	touchpad->fsm.timer_source =
 		wl_event_loop_add_timer(loop, fsm_timout_handler, touchpad);
 	if (touchpad->fsm.timer_source == NULL) {
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <linux/input.h>
@@ -33,6 +34,7 @@
 
 #include "compositor.h"
 #include "evdev.h"
+#include "evdev-thread.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 
@@ -69,27 +71,196 @@ evdev_led_update(struct evdev_device *device, enum weston_led leds)
 static void
 transform_absolute(struct evdev_device *device, int32_t *x, int32_t *y)
 {
-       if (!device->abs.apply_calibration) {
-               *x = device->abs.x;
-               *y = device->abs.y;
+       int32_t ax = *x, ay = *y;
+
+       if (!device->abs.apply_calibration)
                return;
-       } else {
-               *x = device->abs.x * device->abs.calibration[0] +
-                       device->abs.y * device->abs.calibration[1] +
-                       device->abs.calibration[2];
 
-               *y = device->abs.x * device->abs.calibration[3] +
-                       device->abs.y * device->abs.calibration[4] +
-                       device->abs.calibration[5];
-       }
+       *x = ax * device->abs.calibration[0] +
+               ay * device->abs.calibration[1] +
+               device->abs.calibration[2];
+
+       *y = ax * device->abs.calibration[3] +
+               ay * device->abs.calibration[4] +
+               device->abs.calibration[5];
+}
+
+/* Maps raw absolute axis values to global coordinates. This reads the
+ * output, so for devices on the input thread it runs on the main thread,
+ * when the queued event is notified. */
+static int
+evdev_transform_absolute(struct evdev_device *device, int32_t x, int32_t y,
+			 wl_fixed_t *gx, wl_fixed_t *gy)
+{
+	struct weston_output *output = device->output;
+
+	if (output == NULL)
+		return -1;
+
+	x = (x - device->abs.min_x) * output->current_mode->width /
+		(device->abs.max_x - device->abs.min_x);
+	y = (y - device->abs.min_y) * output->current_mode->height /
+		(device->abs.max_y - device->abs.min_y);
+	if (!device->is_mt)
+		transform_absolute(device, &x, &y);
+
+	weston_output_transform_coordinate(output,
+					   wl_fixed_from_int(x),
+					   wl_fixed_from_int(y),
+					   gx, gy);
+
+	return 0;
+}
+
+void
+evdev_device_notify_motion_absolute(struct evdev_device *device,
+				    uint32_t time, int32_t x, int32_t y)
+{
+	wl_fixed_t gx, gy;
+
+	if (evdev_transform_absolute(device, x, y, &gx, &gy) == 0)
+		notify_motion_absolute(device->seat, time, gx, gy);
+}
+
+void
+evdev_device_notify_touch(struct evdev_device *device, uint32_t time,
+			  int touch_id, int32_t x, int32_t y, int touch_type)
+{
+	wl_fixed_t gx = 0, gy = 0;
+
+	if (touch_type != WL_TOUCH_UP &&
+	    evdev_transform_absolute(device, x, y, &gx, &gy) < 0)
+		return;
+
+	notify_touch(device->seat, time, touch_id, gx, gy, touch_type);
+}
+
+static void
+evdev_push(struct evdev_device *device, uint32_t type, uint32_t time,
+	   int32_t a, int32_t b, int32_t c, int32_t d)
+{
+	struct evdev_thread_event event;
+
+	event.type = type;
+	event.time = time;
+	event.seat = device->seat;
+	event.device = device;
+	event.a = a;
+	event.b = b;
+	event.c = c;
+	event.d = d;
+	evdev_thread_push(device->thread, &event);
+}
+
+void
+evdev_notify_motion(struct evdev_device *device, uint32_t time,
+		    wl_fixed_t dx, wl_fixed_t dy)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_MOTION, time, dx, dy, 0, 0);
+	else
+		notify_motion(device->seat, time, dx, dy);
+}
+
+static void
+evdev_notify_motion_absolute(struct evdev_device *device, uint32_t time,
+			     int32_t x, int32_t y)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_MOTION_ABSOLUTE,
+			   time, x, y, 0, 0);
+	else
+		evdev_device_notify_motion_absolute(device, time, x, y);
+}
+
+void
+evdev_notify_button(struct evdev_device *device, uint32_t time,
+		    int32_t button, enum wl_pointer_button_state state)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_BUTTON,
+			   time, button, state, 0, 0);
+	else
+		notify_button(device->seat, time, button, state);
+}
+
+static void
+evdev_notify_key(struct evdev_device *device, uint32_t time,
+		 uint32_t key, enum wl_keyboard_key_state state)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_KEY, time, key, state, 0, 0);
+	else
+		notify_key(device->seat, time, key, state,
+			   STATE_UPDATE_AUTOMATIC);
+}
+
+void
+evdev_notify_axis(struct evdev_device *device, uint32_t time,
+		  uint32_t axis, wl_fixed_t value)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_AXIS, time, axis, value, 0, 0);
+	else
+		notify_axis(device->seat, time, axis, value);
+}
+
+static void
+evdev_notify_touch(struct evdev_device *device, uint32_t time, int touch_id,
+		   int32_t x, int32_t y, int touch_type)
+{
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_TOUCH,
+			   time, touch_id, x, y, touch_type);
+	else
+		evdev_device_notify_touch(device, time, touch_id,
+					  x, y, touch_type);
+	device->touch_frame_pending = 1;
+}
+
+static void
+evdev_notify_touch_motion(struct evdev_device *device, uint32_t time,
+			  int slot)
+{
+	evdev_notify_touch(device, time, device->mt.slots[slot].seat_slot,
+			   device->mt.slots[slot].x, device->mt.slots[slot].y,
+			   WL_TOUCH_MOTION);
+}
+
+static void
+evdev_flush_touch_motion(struct evdev_device *device, uint32_t time)
+{
+	uint32_t pending = device->mt.motion_pending;
+	int slot;
+
+	device->mt.motion_pending = 0;
+	if (device->output == NULL)
+		return;
+
+	while (pending) {
+		slot = ffs(pending) - 1;
+		pending &= ~(1 << slot);
+		evdev_notify_touch_motion(device, time, slot);
+	}
+}
+
+static void
+evdev_flush_touch_frame(struct evdev_device *device)
+{
+	if (!device->touch_frame_pending)
+		return;
+
+	if (device->thread)
+		evdev_push(device, EVDEV_THREAD_TOUCH_FRAME, 0, 0, 0, 0, 0);
+	else
+		notify_touch_frame(device->seat);
+	device->touch_frame_pending = 0;
 }
 
 static void
 evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 {
 	struct weston_seat *master = device->seat;
-	wl_fixed_t x, y;
-	int32_t cx, cy;
 	int slot, seat_slot;
 
 	slot = device->mt.slot;
@@ -97,70 +268,69 @@ evdev_flush_pending_event(struct evdev_device *device, uint32_t time)
 	case EVDEV_NONE:
 		return;
 	case EVDEV_RELATIVE_MOTION:
-		notify_motion(master, time, device->rel.dx, device->rel.dy);
+		evdev_notify_motion(device, time,
+				    device->rel.dx, device->rel.dy);
 		device->rel.dx = 0;
 		device->rel.dy = 0;
 		break;
 	case EVDEV_ABSOLUTE_MT_DOWN:
 		if (device->output == NULL)
 			break;
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(device->mt.slots[slot].x),
-						   wl_fixed_from_int(device->mt.slots[slot].y),
-						   &x, &y);
+		evdev_flush_touch_motion(device, time);
 		seat_slot = ffs(~master->slot_map) - 1;
 		device->mt.slots[slot].seat_slot = seat_slot;
 		master->slot_map |= 1 << seat_slot;
 
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_DOWN);
+		evdev_notify_touch(device, time, seat_slot,
+				   device->mt.slots[slot].x,
+				   device->mt.slots[slot].y, WL_TOUCH_DOWN);
 		break;
 	case EVDEV_ABSOLUTE_MT_MOTION:
 		if (device->output == NULL)
 			break;
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(device->mt.slots[slot].x),
-						   wl_fixed_from_int(device->mt.slots[slot].y),
-						   &x, &y);
-		seat_slot = device->mt.slots[slot].seat_slot;
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_MOTION);
+		if (device->coalesce_touch) {
+			if (device->mt.motion_pending & (1 << slot))
+				device->mt.motion_suppressed++;
+			device->mt.motion_pending |= 1 << slot;
+			break;
+		}
+		evdev_notify_touch_motion(device, time, slot);
 		break;
 	case EVDEV_ABSOLUTE_MT_UP:
+		evdev_flush_touch_motion(device, time);
 		seat_slot = device->mt.slots[slot].seat_slot;
 		master->slot_map &= ~(1 << seat_slot);
-		notify_touch(master, time, seat_slot, 0, 0, WL_TOUCH_UP);
+		evdev_notify_touch(device, time, seat_slot, 0, 0,
+				   WL_TOUCH_UP);
 		break;
 	case EVDEV_ABSOLUTE_TOUCH_DOWN:
 		if (device->output == NULL)
 			break;
-		transform_absolute(device, &cx, &cy);
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(cx),
-						   wl_fixed_from_int(cy),
-						   &x, &y);
 		seat_slot = ffs(~master->slot_map) - 1;
 		device->abs.seat_slot = seat_slot;
 		master->slot_map |= 1 << seat_slot;
-		notify_touch(master, time, seat_slot, x, y, WL_TOUCH_DOWN);
+		evdev_notify_touch(device, time, seat_slot,
+				   device->abs.x, device->abs.y,
+				   WL_TOUCH_DOWN);
 		break;
 	case EVDEV_ABSOLUTE_MOTION:
 		if (device->output == NULL)
 			break;
-		transform_absolute(device, &cx, &cy);
-		weston_output_transform_coordinate(device->output,
-						   wl_fixed_from_int(cx),
-						   wl_fixed_from_int(cy),
-						   &x, &y);
 
 		if (device->seat_caps & EVDEV_SEAT_TOUCH)
-			notify_touch(master, time, device->abs.seat_slot,
-				     x, y, WL_TOUCH_MOTION);
+			evdev_notify_touch(device, time, device->abs.seat_slot,
+					   device->abs.x, device->abs.y,
+					   WL_TOUCH_MOTION);
 		else if (device->seat_caps & EVDEV_SEAT_POINTER)
-			notify_motion_absolute(master, time, x, y);
+			evdev_notify_motion_absolute(device, time,
+						     device->abs.x,
+						     device->abs.y);
 		break;
 	case EVDEV_ABSOLUTE_TOUCH_UP:
 		seat_slot = device->abs.seat_slot;
 		master->slot_map &= ~(1 << seat_slot);
-		notify_touch(master, time, seat_slot, 0, 0, WL_TOUCH_UP);
+		evdev_notify_touch(device, time, seat_slot, 0, 0,
+				   WL_TOUCH_UP);
 		break;
 	default:
 		assert(0 && "Unknown pending event type");
@@ -205,18 +375,17 @@ evdev_process_key(struct evdev_device *device, struct input_event *e, int time)
 	case BTN_FORWARD:
 	case BTN_BACK:
 	case BTN_TASK:
-		notify_button(device->seat,
-			      time, e->code,
-			      e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
-					 WL_POINTER_BUTTON_STATE_RELEASED);
+		evdev_notify_button(device,
+				    time, e->code,
+				    e->value ? WL_POINTER_BUTTON_STATE_PRESSED :
+					       WL_POINTER_BUTTON_STATE_RELEASED);
 		break;
 
 	default:
-		notify_key(device->seat,
-			   time, e->code,
-			   e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
-				      WL_KEYBOARD_KEY_STATE_RELEASED,
-			   STATE_UPDATE_AUTOMATIC);
+		evdev_notify_key(device,
+				 time, e->code,
+				 e->value ? WL_KEYBOARD_KEY_STATE_PRESSED :
+					    WL_KEYBOARD_KEY_STATE_RELEASED);
 		break;
 	}
 }
@@ -226,14 +395,9 @@ evdev_process_touch(struct evdev_device *device,
 		    struct input_event *e,
 		    uint32_t time)
 {
-	int screen_width, screen_height;
-
 	if (device->output == NULL)
 		return;
 
-	screen_width = device->output->current_mode->width;
-	screen_height = device->output->current_mode->height;
-
 	switch (e->code) {
 	case ABS_MT_SLOT:
 		evdev_flush_pending_event(device, time);
@@ -249,16 +413,12 @@ evdev_process_touch(struct evdev_device *device,
 			device->pending_event = EVDEV_ABSOLUTE_MT_UP;
 		break;
 	case ABS_MT_POSITION_X:
-		device->mt.slots[device->mt.slot].x =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x);
+		device->mt.slots[device->mt.slot].x = e->value;
 		if (device->pending_event == EVDEV_NONE)
 			device->pending_event = EVDEV_ABSOLUTE_MT_MOTION;
 		break;
 	case ABS_MT_POSITION_Y:
-		device->mt.slots[device->mt.slot].y =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y);
+		device->mt.slots[device->mt.slot].y = e->value;
 		if (device->pending_event == EVDEV_NONE)
 			device->pending_event = EVDEV_ABSOLUTE_MT_MOTION;
 		break;
@@ -269,26 +429,17 @@ static inline void
 evdev_process_absolute_motion(struct evdev_device *device,
 			      struct input_event *e)
 {
-	int screen_width, screen_height;
-
 	if (device->output == NULL)
 		return;
 
-	screen_width = device->output->current_mode->width;
-	screen_height = device->output->current_mode->height;
-
 	switch (e->code) {
 	case ABS_X:
-		device->abs.x =
-			(e->value - device->abs.min_x) * screen_width /
-			(device->abs.max_x - device->abs.min_x);
+		device->abs.x = e->value;
 		if (device->pending_event == EVDEV_NONE)
 			device->pending_event = EVDEV_ABSOLUTE_MOTION;
 		break;
 	case ABS_Y:
-		device->abs.y =
-			(e->value - device->abs.min_y) * screen_height /
-			(device->abs.max_y - device->abs.min_y);
+		device->abs.y = e->value;
 		if (device->pending_event == EVDEV_NONE)
 			device->pending_event = EVDEV_ABSOLUTE_MOTION;
 		break;
@@ -319,10 +470,10 @@ evdev_process_relative(struct evdev_device *device,
 			/* Scroll down */
 		case 1:
 			/* Scroll up */
-			notify_axis(device->seat,
-				    time,
-				    WL_POINTER_AXIS_VERTICAL_SCROLL,
-				    -1 * e->value * DEFAULT_AXIS_STEP_DISTANCE);
+			evdev_notify_axis(device,
+					  time,
+					  WL_POINTER_AXIS_VERTICAL_SCROLL,
+					  -1 * e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
 		default:
 			break;
@@ -335,10 +486,10 @@ evdev_process_relative(struct evdev_device *device,
 			/* Scroll left */
 		case 1:
 			/* Scroll right */
-			notify_axis(device->seat,
-				    time,
-				    WL_POINTER_AXIS_HORIZONTAL_SCROLL,
-				    e->value * DEFAULT_AXIS_STEP_DISTANCE);
+			evdev_notify_axis(device,
+					  time,
+					  WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+					  e->value * DEFAULT_AXIS_STEP_DISTANCE);
 			break;
 		default:
 			break;
@@ -376,7 +527,13 @@ fallback_process(struct evdev_dispatch *dispatch,
 		evdev_process_key(device, event, time);
 		break;
 	case EV_SYN:
-		evdev_flush_pending_event(device, time);
+		if (device->coalesce_motion &&
+		    device->pending_event == EVDEV_RELATIVE_MOTION)
+			device->rel.time = time;
+		else
+			evdev_flush_pending_event(device, time);
+		device->mt.time = time;
+		evdev_flush_touch_frame(device);
 		break;
 	}
 }
@@ -421,6 +578,33 @@ evdev_process_events(struct evdev_device *device,
 	}
 }
 
+/* Buttons, keys and wheel events flush pending motion before they
+ * are sent, so what is left at the end of a read comes after all of them. */
+static void
+evdev_flush_coalesced_motion(struct evdev_device *device)
+{
+	if (device->coalesce_motion &&
+	    device->pending_event == EVDEV_RELATIVE_MOTION)
+		evdev_flush_pending_event(device, device->rel.time);
+
+	if (device->mt.motion_pending) {
+		evdev_flush_touch_motion(device, device->mt.time);
+		evdev_flush_touch_frame(device);
+	}
+}
+
+static void
+evdev_record_events(struct evdev_device *device,
+		    struct input_event *ev, int len)
+{
+	if (write(device->record_fd, ev, len) != len) {
+		weston_log("failed to record events of %s, stopping\n",
+			   device->devnode);
+		close(device->record_fd);
+		device->record_fd = -1;
+	}
+}
+
 static int
 evdev_device_data(int fd, uint32_t mask, void *data)
 {
@@ -452,24 +636,64 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 				device->source = NULL;
 			}
 
-			return 1;
+			break;
 		}
 
+		if (device->record_fd >= 0 && len > 0)
+			evdev_record_events(device, ev, len);
+
 		evdev_process_events(device, ev, len / sizeof ev[0]);
 
 	} while (len > 0);
 
+	evdev_flush_coalesced_motion(device);
+
 	return 1;
 }
 
+/* Processes events as if they had been read from the device in one go. */
+void
+evdev_device_replay(struct evdev_device *device,
+		    struct input_event *ev, int count)
+{
+	evdev_process_events(device, ev, count);
+	evdev_flush_coalesced_motion(device);
+}
+
+static void
+evdev_query_caps(int fd, struct evdev_device_caps *caps)
+{
+	unsigned int i;
+
+	memset(caps, 0, sizeof *caps);
+
+	strcpy(caps->name, "unknown");
+	ioctl(fd, EVIOCGNAME(sizeof(caps->name)), caps->name);
+	caps->name[sizeof(caps->name) - 1] = '\0';
+
+	ioctl(fd, EVIOCGID, &caps->id);
+	ioctl(fd, EVIOCGBIT(0, sizeof(caps->ev_bits)), caps->ev_bits);
+	if (TEST_BIT(caps->ev_bits, EV_ABS))
+		ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(caps->abs_bits)),
+		      caps->abs_bits);
+	if (TEST_BIT(caps->ev_bits, EV_REL))
+		ioctl(fd, EVIOCGBIT(EV_REL, sizeof(caps->rel_bits)),
+		      caps->rel_bits);
+	if (TEST_BIT(caps->ev_bits, EV_KEY))
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(caps->key_bits)),
+		      caps->key_bits);
+	ioctl(fd, EVIOCGPROP(sizeof(caps->prop_bits)), caps->prop_bits);
+
+	for (i = 0; i < ABS_CNT; i++)
+		if (TEST_BIT(caps->abs_bits, i))
+			ioctl(fd, EVIOCGABS(i), &caps->absinfo[i]);
+}
+
 static int
 evdev_configure_device(struct evdev_device *device)
 {
-	struct input_absinfo absinfo;
-	unsigned long ev_bits[NBITS(EV_MAX)];
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-	unsigned long rel_bits[NBITS(REL_MAX)];
-	unsigned long key_bits[NBITS(KEY_MAX)];
+	struct evdev_device_caps *caps = &device->caps;
+	struct input_absinfo *absinfo;
 	int has_abs, has_rel, has_mt;
 	int has_button, has_keyboard, has_touch;
 	unsigned int i;
@@ -481,41 +705,35 @@ evdev_configure_device(struct evdev_device *device)
 	has_keyboard = 0;
 	has_touch = 0;
 
-	ioctl(device->fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
-	if (TEST_BIT(ev_bits, EV_ABS)) {
-		ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)),
-		      abs_bits);
-
-		if (TEST_BIT(abs_bits, ABS_X)) {
-			ioctl(device->fd, EVIOCGABS(ABS_X), &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
+	if (TEST_BIT(caps->ev_bits, EV_ABS)) {
+		if (TEST_BIT(caps->abs_bits, ABS_X)) {
+			absinfo = &caps->absinfo[ABS_X];
+			device->abs.min_x = absinfo->minimum;
+			device->abs.max_x = absinfo->maximum;
 			has_abs = 1;
 		}
-		if (TEST_BIT(abs_bits, ABS_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_Y), &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+		if (TEST_BIT(caps->abs_bits, ABS_Y)) {
+			absinfo = &caps->absinfo[ABS_Y];
+			device->abs.min_y = absinfo->minimum;
+			device->abs.max_y = absinfo->maximum;
 			has_abs = 1;
 		}
                 /* We only handle the slotted Protocol B in weston.
                    Devices with ABS_MT_POSITION_* but not ABS_MT_SLOT
                    require mtdev for conversion. */
-		if (TEST_BIT(abs_bits, ABS_MT_POSITION_X) &&
-		    TEST_BIT(abs_bits, ABS_MT_POSITION_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_X),
-			      &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_Y),
-			      &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+		if (TEST_BIT(caps->abs_bits, ABS_MT_POSITION_X) &&
+		    TEST_BIT(caps->abs_bits, ABS_MT_POSITION_Y)) {
+			absinfo = &caps->absinfo[ABS_MT_POSITION_X];
+			device->abs.min_x = absinfo->minimum;
+			device->abs.max_x = absinfo->maximum;
+			absinfo = &caps->absinfo[ABS_MT_POSITION_Y];
+			device->abs.min_y = absinfo->minimum;
+			device->abs.max_y = absinfo->maximum;
 			device->is_mt = 1;
 			has_touch = 1;
 			has_mt = 1;
 
-			if (!TEST_BIT(abs_bits, ABS_MT_SLOT)) {
+			if (!TEST_BIT(caps->abs_bits, ABS_MT_SLOT)) {
 				device->mtdev = mtdev_new_open(device->fd);
 				if (!device->mtdev) {
 					weston_log("mtdev required but failed to open for %s\n",
@@ -524,23 +742,19 @@ evdev_configure_device(struct evdev_device *device)
 				}
 				device->mt.slot = device->mtdev->caps.slot.value;
 			} else {
-				ioctl(device->fd, EVIOCGABS(ABS_MT_SLOT),
-				      &absinfo);
-				device->mt.slot = absinfo.value;
+				device->mt.slot =
+					caps->absinfo[ABS_MT_SLOT].value;
 			}
 		}
 	}
-	if (TEST_BIT(ev_bits, EV_REL)) {
-		ioctl(device->fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)),
-		      rel_bits);
-		if (TEST_BIT(rel_bits, REL_X) || TEST_BIT(rel_bits, REL_Y))
+	if (TEST_BIT(caps->ev_bits, EV_REL)) {
+		if (TEST_BIT(caps->rel_bits, REL_X) ||
+		    TEST_BIT(caps->rel_bits, REL_Y))
 			has_rel = 1;
 	}
-	if (TEST_BIT(ev_bits, EV_KEY)) {
-		ioctl(device->fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)),
-		      key_bits);
-		if (TEST_BIT(key_bits, BTN_TOOL_FINGER) &&
-		    !TEST_BIT(key_bits, BTN_TOOL_PEN) &&
+	if (TEST_BIT(caps->ev_bits, EV_KEY)) {
+		if (TEST_BIT(caps->key_bits, BTN_TOOL_FINGER) &&
+		    !TEST_BIT(caps->key_bits, BTN_TOOL_PEN) &&
 		    (has_abs || has_mt)) {
 			device->dispatch = evdev_touchpad_create(device);
 			weston_log("input device %s, %s is a touchpad\n",
@@ -549,21 +763,21 @@ evdev_configure_device(struct evdev_device *device)
 		for (i = KEY_ESC; i < KEY_MAX; i++) {
 			if (i >= BTN_MISC && i < KEY_OK)
 				continue;
-			if (TEST_BIT(key_bits, i)) {
+			if (TEST_BIT(caps->key_bits, i)) {
 				has_keyboard = 1;
 				break;
 			}
 		}
-		if (TEST_BIT(key_bits, BTN_TOUCH))
+		if (TEST_BIT(caps->key_bits, BTN_TOUCH))
 			has_touch = 1;
 		for (i = BTN_MISC; i < BTN_JOYSTICK; i++) {
-			if (TEST_BIT(key_bits, i)) {
+			if (TEST_BIT(caps->key_bits, i)) {
 				has_button = 1;
 				break;
 			}
 		}
 	}
-	if (TEST_BIT(ev_bits, EV_LED))
+	if (TEST_BIT(caps->ev_bits, EV_LED))
 		has_keyboard = 1;
 
 	if ((has_abs || has_rel) && has_button) {
@@ -592,6 +806,20 @@ evdev_configure_device(struct evdev_device *device)
 	return 0;
 }
 
+static void
+evdev_device_lock(struct evdev_device *device)
+{
+	if (device->thread)
+		evdev_thread_lock(device->thread);
+}
+
+static void
+evdev_device_unlock(struct evdev_device *device)
+{
+	if (device->thread)
+		evdev_thread_unlock(device->thread);
+}
+
 static void
 notify_output_destroy(struct wl_listener *listener, void *data)
 {
@@ -606,7 +834,9 @@ notify_output_destroy(struct wl_listener *listener, void *data)
 				      struct weston_output, link);
 		evdev_device_set_output(device, output);
 	} else {
+		evdev_device_lock(device);
 		device->output = NULL;
+		evdev_device_unlock(device);
 	}
 }
 
@@ -619,18 +849,72 @@ evdev_device_set_output(struct evdev_device *device,
 		device->output_destroy_listener.notify = NULL;
 	}
 
+	evdev_device_lock(device);
 	device->output = output;
+	evdev_device_unlock(device);
 	device->output_destroy_listener.notify = notify_output_destroy;
 	wl_signal_add(&output->destroy_signal,
 		      &device->output_destroy_listener);
 }
 
-struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+static void
+evdev_device_start_recording(struct evdev_device *device, const char *dir)
+{
+	struct evdev_record_header header;
+	struct evdev_device_caps caps;
+	const char *name;
+	char *path;
+	int fd;
+
+	name = strrchr(device->devnode, '/');
+	name = name ? name + 1 : device->devnode;
+	if (asprintf(&path, "%s/%s.evrec", dir, name) < 0)
+		return;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		weston_log("failed to open event recording %s: %m\n", path);
+		free(path);
+		return;
+	}
+
+	/* Events come out of mtdev already slotted, replay them as such. */
+	caps = device->caps;
+	if (device->mtdev) {
+		caps.abs_bits[LONG(ABS_MT_SLOT)] |= BIT(ABS_MT_SLOT);
+		caps.absinfo[ABS_MT_SLOT].value = device->mt.slot;
+	}
+
+	header.magic = EVDEV_RECORD_MAGIC;
+	header.version = EVDEV_RECORD_VERSION;
+	header.caps_size = sizeof caps;
+	header.event_size = sizeof(struct input_event);
+
+	if (write(fd, &header, sizeof header) != sizeof header ||
+	    write(fd, &caps, sizeof caps) != sizeof caps) {
+		weston_log("failed to write event recording %s\n", path);
+		close(fd);
+		free(path);
+		return;
+	}
+
+	weston_log("recording events of %s to %s\n", device->devnode, path);
+	device->record_fd = fd;
+	free(path);
+}
+
+static struct evdev_device *
+evdev_device_create_with_caps(struct weston_seat *seat, const char *path,
+			      int device_fd,
+			      const struct evdev_device_caps *caps,
+			      struct evdev_thread *thread)
 {
 	struct evdev_device *device;
 	struct weston_compositor *ec;
-	char devname[256] = "unknown";
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+	const char *record_dir;
+	int ret;
 
 	device = zalloc(sizeof *device);
 	if (device == NULL)
@@ -645,16 +929,27 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->mt.slot = -1;
 	device->rel.dx = 0;
 	device->rel.dy = 0;
+	device->rel.time = 0;
 	device->dispatch = NULL;
 	device->fd = device_fd;
+	device->thread = thread;
+	device->record_fd = -1;
 	device->pending_event = EVDEV_NONE;
+	device->caps = *caps;
+	device->devname = strdup(caps->name);
 	wl_list_init(&device->link);
 
-	ioctl(device->fd, EVIOCGNAME(sizeof(devname)), devname);
-	devname[sizeof(devname) - 1] = '\0';
-	device->devname = strdup(devname);
-
-	if (evdev_configure_device(device) == -1)
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "coalesce-motion",
+				       &device->coalesce_motion, 0);
+	weston_config_section_get_bool(section, "coalesce-touch",
+				       &device->coalesce_touch, 0);
+
+	/* The touchpad adds its timer to the thread's loop. */
+	evdev_device_lock(device);
+	ret = evdev_configure_device(device);
+	evdev_device_unlock(device);
+	if (ret == -1)
 		goto err;
 
 	if (device->seat_caps == 0) {
@@ -668,12 +963,27 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	if (device->dispatch == NULL)
 		goto err;
 
-	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
+	/* Replayed devices are fed through evdev_device_replay(). */
+	if (device_fd < 0)
+		return device;
+
+	if (thread)
+		loop = evdev_thread_get_loop(thread);
+	else
+		loop = ec->input_loop;
+
+	evdev_device_lock(device);
+	device->source = wl_event_loop_add_fd(loop, device->fd,
 					      WL_EVENT_READABLE,
 					      evdev_device_data, device);
+	evdev_device_unlock(device);
 	if (device->source == NULL)
 		goto err;
 
+	record_dir = getenv("WESTON_EVDEV_RECORD");
+	if (record_dir)
+		evdev_device_start_recording(device, record_dir);
+
 	return device;
 
 err:
@@ -681,30 +991,63 @@ err:
 	return NULL;
 }
 
+struct evdev_device *
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_thread *thread)
+{
+	struct evdev_device_caps caps;
+
+	evdev_query_caps(device_fd, &caps);
+
+	return evdev_device_create_with_caps(seat, path, device_fd, &caps,
+					     thread);
+}
+
+struct evdev_device *
+evdev_device_create_replay(struct weston_seat *seat, const char *path,
+			   const struct evdev_device_caps *caps)
+{
+	return evdev_device_create_with_caps(seat, path, -1, caps, NULL);
+}
+
 void
 evdev_device_destroy(struct evdev_device *device)
 {
 	struct evdev_dispatch *dispatch;
 
+	/* Stop the thread from reading the device, then run what it queued
+	 * while the seat still has the device's capabilities. */
+	evdev_device_lock(device);
+	if (device->source)
+		wl_event_source_remove(device->source);
+	device->source = NULL;
+	dispatch = device->dispatch;
+	if (dispatch)
+		dispatch->interface->destroy(dispatch);
+	evdev_device_unlock(device);
+	if (device->thread)
+		evdev_thread_flush(device->thread);
+
 	if (device->seat_caps & EVDEV_SEAT_POINTER)
 		weston_seat_release_pointer(device->seat);
 	if (device->seat_caps & EVDEV_SEAT_KEYBOARD)
 		weston_seat_release_keyboard(device->seat);
 	if (device->seat_caps & EVDEV_SEAT_TOUCH)
 		weston_seat_release_touch(device->seat);
+	if (device->mt.motion_suppressed)
+		weston_log("input device %s: %llu touch motion events "
+			   "coalesced\n", device->devnode,
+			   (unsigned long long) device->mt.motion_suppressed);
 
-	dispatch = device->dispatch;
-	if (dispatch)
-		dispatch->interface->destroy(dispatch);
-
-	if (device->source)
-		wl_event_source_remove(device->source);
 	if (device->output)
 		wl_list_remove(&device->output_destroy_listener.link);
 	wl_list_remove(&device->link);
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
-	close(device->fd);
+	if (device->record_fd >= 0)
+		close(device->record_fd);
+	if (device->fd >= 0)
+		close(device->fd);
 	free(device->devname);
 	free(device->devnode);
 	free(device->output_name);
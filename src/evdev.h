@@ -47,6 +47,42 @@ enum evdev_device_seat_capability {
 	EVDEV_SEAT_TOUCH = (1 << 2)
 };
 
+/* copied from udev/extras/input_id/input_id.c */
+/* we must use this kernel-compatible implementation */
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
+#define OFF(x)  ((x)%BITS_PER_LONG)
+#define BIT(x)  (1UL<<OFF(x))
+#define LONG(x) ((x)/BITS_PER_LONG)
+#define TEST_BIT(array, bit)    ((array[LONG(bit)] >> OFF(bit)) & 1)
+/* end copied */
+
+/* Everything evdev_configure_device() and the touchpad code need to know
+ * about a device, as queried from the kernel or read from a recording. */
+struct evdev_device_caps {
+	char name[256];
+	struct input_id id;
+	unsigned long ev_bits[NBITS(EV_MAX)];
+	unsigned long abs_bits[NBITS(ABS_MAX)];
+	unsigned long rel_bits[NBITS(REL_MAX)];
+	unsigned long key_bits[NBITS(KEY_MAX)];
+	unsigned long prop_bits[NBITS(INPUT_PROP_MAX)];
+	struct input_absinfo absinfo[ABS_CNT];
+};
+
+/* An event recording starts with this header and the device caps,
+ * followed by the struct input_event stream as read from the device.
+ * The format is that of the recording machine. */
+#define EVDEV_RECORD_MAGIC	0x52564557	/* "WEVR" */
+#define EVDEV_RECORD_VERSION	1
+
+struct evdev_record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t caps_size;
+	uint32_t event_size;
+};
+
 struct evdev_device {
 	struct weston_seat *seat;
 	struct wl_list link;
@@ -73,32 +109,45 @@ struct evdev_device {
 			int32_t x, y;
 			uint32_t seat_slot;
 		} slots[MAX_SLOTS];
+		uint32_t motion_pending;	/* bit per slot */
+		uint32_t time;
+		uint64_t motion_suppressed;
 	} mt;
 	struct mtdev *mtdev;
 
 	struct {
 		wl_fixed_t dx, dy;
+		uint32_t time;
 	} rel;
 
+	/* Keep summing relative motion across SYN_REPORTs and send it
+	 * once per read of the device, i.e. once per frame while the
+	 * compositor is repainting. */
+	int coalesce_motion;
+
+	/* Likewise for touch motion, per slot. Touch down and up events
+	 * are sent right away, after all pending motion. */
+	int coalesce_touch;
+	int touch_frame_pending;
+
 	enum evdev_event_type pending_event;
 	enum evdev_device_seat_capability seat_caps;
+	struct evdev_device_caps caps;
+
+	/* Event recording, see WESTON_EVDEV_RECORD */
+	int record_fd;
+
+	/* The input thread reading the device, or NULL to read it on the
+	 * main thread */
+	struct evdev_thread *thread;
 
 	int is_mt;
 };
 
-/* copied from udev/extras/input_id/input_id.c */
-/* we must use this kernel-compatible implementation */
-#define BITS_PER_LONG (sizeof(unsigned long) * 8)
-#define NBITS(x) ((((x)-1)/BITS_PER_LONG)+1)
-#define OFF(x)  ((x)%BITS_PER_LONG)
-#define BIT(x)  (1UL<<OFF(x))
-#define LONG(x) ((x)/BITS_PER_LONG)
-#define TEST_BIT(array, bit)    ((array[LONG(bit)] >> OFF(bit)) & 1)
-/* end copied */
-
 #define EVDEV_UNHANDLED_DEVICE ((struct evdev_device *) 1)
 
 struct evdev_dispatch;
+struct evdev_thread;
 
 struct evdev_dispatch_interface {
 	/* Process an evdev input event. */
@@ -115,14 +164,51 @@ struct evdev_dispatch {
 	struct evdev_dispatch_interface *interface;
 };
 
+/* The kernel timestamp of an event in microseconds, for the motion filters.
+ * Protocol times stay in milliseconds. */
+static inline uint64_t
+evdev_event_time_usec(const struct input_event *e)
+{
+	return (uint64_t) e->time.tv_sec * 1000000 + e->time.tv_usec;
+}
+
 struct evdev_dispatch *
 evdev_touchpad_create(struct evdev_device *device);
 
 void
 evdev_led_update(struct evdev_device *device, enum weston_led leds);
 
+void
+evdev_notify_motion(struct evdev_device *device, uint32_t time,
+		    wl_fixed_t dx, wl_fixed_t dy);
+
+void
+evdev_notify_button(struct evdev_device *device, uint32_t time,
+		    int32_t button, enum wl_pointer_button_state state);
+
+void
+evdev_notify_axis(struct evdev_device *device, uint32_t time,
+		  uint32_t axis, wl_fixed_t value);
+
+void
+evdev_device_notify_motion_absolute(struct evdev_device *device,
+				    uint32_t time, int32_t x, int32_t y);
+
+void
+evdev_device_notify_touch(struct evdev_device *device, uint32_t time,
+			  int touch_id, int32_t x, int32_t y, int touch_type);
+
+struct evdev_device *
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd,
+		    struct evdev_thread *thread);
+
 struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
+evdev_device_create_replay(struct weston_seat *seat, const char *path,
+			   const struct evdev_device_caps *caps);
+
+void
+evdev_device_replay(struct evdev_device *device,
+		    struct input_event *ev, int count);
 
 void
 evdev_device_set_output(struct evdev_device *device,
@@ -35,7 +35,7 @@
 void
 weston_filter_dispatch(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time)
+		       void *data, uint64_t time)
 {
 	filter->interface->filter(filter, motion, data, time);
 }
@@ -45,13 +45,13 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
  */
 
 #define MAX_VELOCITY_DIFF	1.0
-#define MOTION_TIMEOUT		300 /* (ms) */
+#define MOTION_TIMEOUT		300000 /* (us) */
 #define NUM_POINTER_TRACKERS	16
 
 struct pointer_tracker {
 	double dx;
 	double dy;
-	uint32_t time;
+	uint64_t time;
 	int dir;
 };
 
@@ -131,7 +131,7 @@ get_direction(int dx, int dy)
 static void
 feed_trackers(struct pointer_accelerator *accel,
 	      double dx, double dy,
-	      uint32_t time)
+	      uint64_t time)
 {
 	int i, current;
 	struct pointer_tracker *trackers = accel->trackers;
@@ -160,7 +160,7 @@ tracker_by_offset(struct pointer_accelerator *accel, unsigned int offset)
 }
 
 static double
-calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
+calculate_tracker_velocity(struct pointer_tracker *tracker, uint64_t time)
 {
 	int dx;
 	int dy;
@@ -169,11 +169,11 @@ calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
 	dx = tracker->dx;
 	dy = tracker->dy;
 	distance = sqrt(dx*dx + dy*dy);
-	return distance / (double)(time - tracker->time);
+	return distance / ((time - tracker->time) / 1000.0);
 }
 
 static double
-calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
+calculate_velocity(struct pointer_accelerator *accel, uint64_t time)
 {
 	struct pointer_tracker *tracker;
 	double velocity;
@@ -227,14 +227,14 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 
 static double
 acceleration_profile(struct pointer_accelerator *accel,
-		     void *data, double velocity, uint32_t time)
+		     void *data, double velocity, uint64_t time)
 {
 	return accel->profile(&accel->base, data, velocity, time);
 }
 
 static double
 calculate_acceleration(struct pointer_accelerator *accel,
-		       void *data, double velocity, uint32_t time)
+		       void *data, double velocity, uint64_t time)
 {
 	double factor;
 
@@ -276,7 +276,7 @@ apply_softening(struct pointer_accelerator *accel,
 static void
 accelerator_filter(struct weston_motion_filter *filter,
 		   struct weston_motion_params *motion,
-		   void *data, uint32_t time)
+		   void *data, uint64_t time)
 {
 	struct pointer_accelerator *accel =
 		(struct pointer_accelerator *) filter;
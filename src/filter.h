@@ -35,16 +35,17 @@ struct weston_motion_params {
 
 struct weston_motion_filter;
 
+/* Times are in microseconds, from the kernel event timestamps. */
 WL_EXPORT void
 weston_filter_dispatch(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time);
+		       void *data, uint64_t time);
 
 
 struct weston_motion_filter_interface {
 	void (*filter)(struct weston_motion_filter *filter,
 		       struct weston_motion_params *motion,
-		       void *data, uint32_t time);
+		       void *data, uint64_t time);
 	void (*destroy)(struct weston_motion_filter *filter);
 };
 
@@ -55,10 +56,11 @@ struct weston_motion_filter {
 WL_EXPORT struct weston_motion_filter *
 create_linear_acceleration_filter(double speed);
 
+/* velocity is in device units per millisecond */
 typedef double (*accel_profile_func_t)(struct weston_motion_filter *filter,
 				       void *data,
 				       double velocity,
-				       uint32_t time);
+				       uint64_t time);
 
 WL_EXPORT struct weston_motion_filter *
 create_pointer_accelator_filter(accel_profile_func_t filter);
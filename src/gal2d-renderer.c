@@ -32,6 +32,7 @@
 
 #include "compositor.h"
 #include "gal2d-renderer.h"
+#include "region-util.h"
 #include "vertex-clipping.h"
 #include "HAL/gc_hal.h"
 #include "HAL/gc_hal_raster.h"
@@ -561,27 +562,10 @@ OnError:
 	return status;
  }
 
-static int
-is_view_visible(struct weston_view *view)
-{
-	/* Return false, if surface is guaranteed to be totally obscured. */
-	int ret;
-	pixman_region32_t unocc;
-
-	pixman_region32_init(&unocc);
-	pixman_region32_subtract(&unocc, &view->transform.boundingbox,
-				 &view->clip);
-	ret = pixman_region32_not_empty(&unocc);
-	pixman_region32_fini(&unocc);
-
-	return ret;
-}
- 
 static int
 use_output(struct weston_output *output)
 {
-    struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **v, *view;
     struct gal2d_output_state *go = get_output_state(output);	
 	struct gal2d_renderer *gr = get_renderer(output->compositor);    
     gceSTATUS status = gcvSTATUS_OK;
@@ -593,9 +577,10 @@ use_output(struct weston_output *output)
     surface = go->renderSurf[go->activebuffer];
     if(go->nNumBuffers == 1)
     {
-        wl_list_for_each_reverse(view, &compositor->view_list, link)
-    		if (view->plane == &compositor->primary_plane && is_view_visible(view))
+        /* Only views not totally obscured are in visible_views. */
+        wl_array_for_each(v, &output->visible_views)
             {   
+                view = *v;
                 visibleViews++;
                 if(view->surface->width == go->width && view->surface->height == go->height)
                 {
@@ -852,12 +837,8 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	pixman_region32_t surface_blend;
 	pixman_region32_t *buffer_damage;
 
-    pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
-
-	if (!pixman_region32_not_empty(&repaint))
+	if (!region_init_repaint(&repaint, &ev->transform.boundingbox,
+				 damage, &ev->clip))
 		goto out;
 
 	buffer_damage = &go->buffer_damage[go->current_buffer];
@@ -898,8 +879,7 @@ out:
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **view;
 	struct gal2d_output_state *go = get_output_state(output);
  	
     if(go->nNumBuffers > 1)
@@ -909,9 +889,8 @@ repaint_views(struct weston_output *output, pixman_region32_t *damage)
     }
     go->activebuffer = (go->activebuffer+1) % go->nNumBuffers;
     
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_array_for_each(view, &output->visible_views)
+		draw_view(*view, output, damage);
 }
 
 static void
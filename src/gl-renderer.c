@@ -33,6 +33,7 @@
 #include <linux/input.h>
 
 #include "gl-renderer.h"
+#include "region-util.h"
 #include "vertex-clipping.h"
 
 #include <EGL/eglext.h>
@@ -540,12 +541,8 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!gs->shader)
 		return;
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.masked_boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
-
-	if (!pixman_region32_not_empty(&repaint))
+	if (!region_init_repaint(&repaint, &ev->transform.masked_boundingbox,
+				 damage, &ev->clip))
 		goto out;
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -611,12 +608,10 @@ out:
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **view;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_array_for_each(view, &output->visible_views)
+		draw_view(*view, output, damage);
 }
 
 static void
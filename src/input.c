@@ -24,12 +24,17 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "../shared/os-compatibility.h"
 #include "compositor.h"
@@ -1895,6 +1900,98 @@ bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 }
 
 #ifdef ENABLE_XKBCOMMON
+static struct weston_xkb_info *
+weston_xkb_info_create_from_names(struct xkb_context *context,
+				  const struct xkb_rule_names *names);
+
+/* The global keymap is compiled on a thread from weston_compositor_xkb_init()
+ * on, while the backend probes its outputs, and picked up when the first
+ * keyboard needs it. The thread has an xkb context of its own, so the main
+ * thread can keep using the compositor's. */
+struct weston_xkb_build {
+	pthread_t thread;
+	struct xkb_rule_names names;
+	struct weston_xkb_info *xkb_info;
+	struct timespec start, end;
+};
+
+static int
+timespec_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 +
+	       (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+static void *
+xkb_build_thread(void *data)
+{
+	struct weston_xkb_build *build = data;
+	struct xkb_context *context;
+
+	context = xkb_context_new(0);
+	if (context) {
+		build->xkb_info =
+			weston_xkb_info_create_from_names(context,
+							  &build->names);
+		xkb_context_unref(context);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &build->end);
+
+	return NULL;
+}
+
+static void
+weston_compositor_start_xkb_build(struct weston_compositor *ec)
+{
+	struct weston_xkb_build *build;
+
+	if (ec->xkb_info || ec->xkb_build)
+		return;
+
+	build = zalloc(sizeof *build);
+	if (build == NULL)
+		return;
+
+	build->names = ec->xkb_names;
+	clock_gettime(CLOCK_MONOTONIC, &build->start);
+	if (pthread_create(&build->thread, NULL, xkb_build_thread, build)) {
+		free(build);
+		return;
+	}
+
+	ec->xkb_build = build;
+}
+
+/* Waits for the keymap thread, and takes its keymap if it compiled one. */
+static void
+weston_compositor_finish_xkb_build(struct weston_compositor *ec)
+{
+	struct weston_xkb_build *build = ec->xkb_build;
+	struct timespec wait_start, wait_end;
+
+	if (build == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &wait_start);
+	pthread_join(build->thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &wait_end);
+	ec->xkb_build = NULL;
+
+	if (build->xkb_info) {
+		weston_log("built XKB keymap in %d ms on a thread, "
+			   "waited %d ms for it\n",
+			   timespec_diff_ms(&build->end, &build->start),
+			   timespec_diff_ms(&wait_end, &wait_start));
+		if (ec->xkb_info)
+			weston_xkb_info_destroy(build->xkb_info);
+		else
+			ec->xkb_info = build->xkb_info;
+	}
+
+	free(build);
+}
+
 int
 weston_compositor_xkb_init(struct weston_compositor *ec,
 			   struct xkb_rule_names *names)
@@ -1918,6 +2015,8 @@ weston_compositor_xkb_init(struct weston_compositor *ec,
 	if (!ec->xkb_names.layout)
 		ec->xkb_names.layout = strdup("us");
 
+	weston_compositor_start_xkb_build(ec);
+
 	return 0;
 }
 
@@ -1946,6 +2045,8 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 	if (!ec->use_xkbcommon)
 		return;
 
+	weston_compositor_finish_xkb_build(ec);
+
 	free((char *) ec->xkb_names.rules);
 	free((char *) ec->xkb_names.model);
 	free((char *) ec->xkb_names.layout);
@@ -1957,8 +2058,9 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 	xkb_context_unref(ec->xkb_context);
 }
 
+/* Creates the xkb_info of keymap, without the keymap file for clients */
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_new(struct xkb_keymap *keymap)
 {
 	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
 	if (xkb_info == NULL)
@@ -1966,8 +2068,7 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 
 	xkb_info->keymap = xkb_keymap_ref(keymap);
 	xkb_info->ref_count = 1;
-
-	char *keymap_str;
+	xkb_info->keymap_fd = -1;
 
 	xkb_info->shift_mod = xkb_keymap_mod_get_index(xkb_info->keymap,
 						       XKB_MOD_NAME_SHIFT);
@@ -1993,6 +2094,19 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 	xkb_info->scroll_led = xkb_keymap_led_get_index(xkb_info->keymap,
 							XKB_LED_NAME_SCROLL);
 
+	return xkb_info;
+}
+
+static struct weston_xkb_info *
+weston_xkb_info_create(struct xkb_keymap *keymap)
+{
+	struct weston_xkb_info *xkb_info;
+	char *keymap_str;
+
+	xkb_info = weston_xkb_info_new(keymap);
+	if (xkb_info == NULL)
+		return NULL;
+
 	keymap_str = xkb_keymap_get_as_string(xkb_info->keymap,
 					      XKB_KEYMAP_FORMAT_TEXT_V1);
 	if (keymap_str == NULL) {
@@ -2031,18 +2145,205 @@ err_keymap:
 	return NULL;
 }
 
+/*
+ * Compiled keymaps are kept in $XDG_CACHE_HOME/weston, as the keymap text
+ * that clients get, after a comment line with what the keymap was compiled
+ * from: the RMLVO names, the xkeyboard-config version, and the
+ * modification time of the rules file. A keymap found there is parsed,
+ * which is much faster than compiling it, and the file itself is handed
+ * to the clients.
+ */
+
 static int
-weston_compositor_build_global_keymap(struct weston_compositor *ec)
+xkb_cache_dir(char *path, size_t size)
 {
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if (getenv("WESTON_KEYMAP_NO_CACHE"))
+		return -1;
+
+	if (cache_home) {
+		snprintf(path, size, "%s/weston", cache_home);
+	} else if (home) {
+		snprintf(path, size, "%s/.cache", home);
+		mkdir(path, 0700);
+		snprintf(path, size, "%s/.cache/weston", home);
+	} else {
+		return -1;
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static char *
+xkb_cache_key(struct xkb_context *context, const struct xkb_rule_names *names)
+{
+	char path[PATH_MAX], *key;
+	struct stat st;
+	long mtime = 0;
+	unsigned int i;
+
+	for (i = 0; i < xkb_context_num_include_paths(context); i++) {
+		snprintf(path, sizeof path, "%s/rules/%s",
+			 xkb_context_include_path_get(context, i),
+			 names->rules);
+		if (stat(path, &st) == 0) {
+			mtime = st.st_mtime;
+			break;
+		}
+	}
+
+	if (asprintf(&key, "// weston keymap cache: rules=%s model=%s "
+		     "layout=%s variant=%s options=%s xkeyboard-config=%s "
+		     "rules-mtime=%ld\n",
+		     names->rules, names->model, names->layout,
+		     names->variant ? names->variant : "",
+		     names->options ? names->options : "",
+		     XKEYBOARD_CONFIG_VERSION, mtime) < 0)
+		return NULL;
+
+	return key;
+}
+
+static uint32_t
+xkb_cache_hash(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s) {
+		hash ^= (unsigned char) *s++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Opens the cached keymap file, and maps it as the keymap for clients */
+static struct weston_xkb_info *
+xkb_cache_load(struct xkb_context *context, const char *path, const char *key)
+{
+	struct weston_xkb_info *xkb_info;
+	struct xkb_keymap *keymap;
+	size_t key_len = strlen(key);
+	struct stat st;
+	char *area;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size <= key_len + 1) {
+		close(fd);
+		return NULL;
+	}
+
+	area = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	keymap = NULL;
+	if (memcmp(area, key, key_len) == 0 && area[st.st_size - 1] == '\0')
+		keymap = xkb_keymap_new_from_string(context, area,
+						    XKB_KEYMAP_FORMAT_TEXT_V1,
+						    0);
+	xkb_info = keymap ? weston_xkb_info_new(keymap) : NULL;
+	xkb_keymap_unref(keymap);
+	if (xkb_info == NULL) {
+		munmap(area, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	xkb_info->keymap_fd = fd;
+	xkb_info->keymap_size = st.st_size;
+	xkb_info->keymap_area = area;
+
+	return xkb_info;
+}
+
+/* Writes the keymap of xkb_info to the cache, through a temporary file so
+ * that no other compositor ever reads a partly written one */
+static void
+xkb_cache_store(const char *path, const char *key,
+		struct weston_xkb_info *xkb_info)
+{
+	char tmp[PATH_MAX + 8];
+	FILE *fp;
+	int fd, ok;
+
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	ok = fputs(key, fp) >= 0 &&
+	     fwrite(xkb_info->keymap_area, xkb_info->keymap_size, 1, fp) == 1;
+	if (fclose(fp) != 0 || !ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+/* Creates the xkb_info of the keymap of names, from the cache if it is
+ * there, or by compiling and then caching it. */
+static struct weston_xkb_info *
+weston_xkb_info_create_from_names(struct xkb_context *context,
+				  const struct xkb_rule_names *names)
+{
+	struct weston_xkb_info *xkb_info;
 	struct xkb_keymap *keymap;
+	char dir[PATH_MAX], path[PATH_MAX + 32], *key = NULL;
+
+	if (xkb_cache_dir(dir, sizeof dir) == 0)
+		key = xkb_cache_key(context, names);
+	if (key) {
+		snprintf(path, sizeof path, "%s/keymap-%08x", dir,
+			 xkb_cache_hash(key));
+		xkb_info = xkb_cache_load(context, path, key);
+		if (xkb_info) {
+			free(key);
+			return xkb_info;
+		}
+	}
 
+	keymap = xkb_keymap_new_from_names(context, names, 0);
+	if (keymap == NULL) {
+		free(key);
+		return NULL;
+	}
+
+	xkb_info = weston_xkb_info_create(keymap);
+	xkb_keymap_unref(keymap);
+
+	if (xkb_info && key)
+		xkb_cache_store(path, key, xkb_info);
+	free(key);
+
+	return xkb_info;
+}
+
+static int
+weston_compositor_build_global_keymap(struct weston_compositor *ec)
+{
+	weston_compositor_finish_xkb_build(ec);
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
-	if (keymap == NULL) {
+	ec->xkb_info = weston_xkb_info_create_from_names(ec->xkb_context,
+							 &ec->xkb_names);
+	if (ec->xkb_info == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
 			"options %s\n",
@@ -2052,11 +2353,6 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
-	xkb_keymap_unref(keymap);
-	if (ec->xkb_info == NULL)
-		return -1;
-
 	return 0;
 }
 #else
@@ -115,6 +115,30 @@ weston_log(const char *fmt, ...)
 	return l;
 }
 
+static double
+timespec_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000.0 +
+	       (a->tv_nsec - b->tv_nsec) / 1000000.0;
+}
+
+/* Logs a phase of startup, with the time since the first phase logged
+ * and since the previous one. */
+WL_EXPORT void
+weston_log_startup(const char *phase)
+{
+	static struct timespec begin, last;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (begin.tv_sec == 0 && begin.tv_nsec == 0)
+		begin = last = now;
+
+	weston_log("startup: %s at %.1f ms (+%.1f ms)\n", phase,
+		   timespec_ms(&now, &begin), timespec_ms(&now, &last));
+	last = now;
+}
+
 WL_EXPORT int
 weston_vlog_continue(const char *fmt, va_list argp)
 {
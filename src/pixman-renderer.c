@@ -25,8 +25,10 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pixman-renderer.h"
+#include "region-util.h"
 
 #include <linux/input.h>
 
@@ -34,6 +36,20 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* The bottom views of the output that are in static layers,
+	 * composited once and copied from on repaint, the views that
+	 * went into it and what of it is stale, in global coordinates */
+	void *static_buffer;
+	pixman_image_t *static_image;
+	struct wl_array static_views;	/* struct static_view */
+	pixman_region32_t static_damage;
+};
+
+struct static_view {
+	struct weston_view *view;
+	pixman_box32_t box;
+	float alpha;
 };
 
 struct pixman_surface_state {
@@ -383,7 +399,8 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+	  pixman_region32_t *damage, /* in global coordinates */
+	  pixman_region32_t *clip)
 {
 	static int zoom_logged = 0;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
@@ -396,12 +413,8 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!ps->image)
 		return;
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.masked_boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
-
-	if (!pixman_region32_not_empty(&repaint))
+	if (!region_init_repaint(&repaint, &ev->transform.masked_boundingbox,
+				 damage, clip))
 		goto out;
 
 	if (output->zoom.active && !zoom_logged) {
@@ -416,9 +429,9 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		repaint_region(ev, output, &repaint, NULL, PIXMAN_OP_OVER);
 	} else {
 		/* blended region is whole surface minus opaque region: */
-		pixman_region32_init_rect(&surface_blend, 0, 0,
-					  ev->surface->width, ev->surface->height);
-		pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
+		region_init_blend(&surface_blend,
+				  ev->surface->width, ev->surface->height,
+				  &ev->surface->opaque);
 
 		if (pixman_region32_not_empty(&ev->surface->opaque)) {
 			repaint_region(ev, output, &repaint, &ev->surface->opaque, PIXMAN_OP_SRC);
@@ -434,15 +447,179 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 out:
 	pixman_region32_fini(&repaint);
 }
+
+static int
+view_is_static(struct weston_view *ev)
+{
+	return ev->layer_link.layer && ev->layer_link.layer->is_static;
+}
+
+/* Marks all of the cache stale when the static views changed since it
+ * was drawn; their contents changing is caught by damage_static_views(). */
+static void
+update_static_views(struct weston_output *output,
+		    struct weston_view **views, int n)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct static_view *sv = po->static_views.data;
+	pixman_box32_t *box;
+	int i;
+
+	if (po->static_views.size == n * sizeof *sv) {
+		for (i = 0; i < n; i++) {
+			box = pixman_region32_extents(
+				&views[i]->transform.boundingbox);
+			if (sv[i].view != views[i] ||
+			    sv[i].alpha != views[i]->alpha ||
+			    memcmp(&sv[i].box, box, sizeof *box) != 0)
+				break;
+		}
+		if (i == n)
+			return;
+	}
+
+	po->static_views.size = 0;
+	for (i = 0; i < n; i++) {
+		sv = wl_array_add(&po->static_views, sizeof *sv);
+		if (!sv) {
+			po->static_views.size = 0;
+			break;
+		}
+		sv->view = views[i];
+		sv->box = *pixman_region32_extents(
+			&views[i]->transform.boundingbox);
+		sv->alpha = views[i]->alpha;
+	}
+
+	pixman_region32_copy(&po->static_damage, &output->region);
+}
+
+/* Repaints the damage of the bottom n views, which are in static layers,
+ * by copying from the cache, after redrawing the stale part of it that
+ * is needed. Returns -1 if there is no cache. */
+static int
+repaint_static_views(struct weston_output *output,
+		     struct weston_view **views, int n,
+		     pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_image_t *shadow_image;
+	pixman_region32_t region, redraw, no_clip;
+	int i, w, h;
+
+	if (!po->static_image) {
+		w = pixman_image_get_width(po->shadow_image);
+		h = pixman_image_get_height(po->shadow_image);
+		po->static_buffer = calloc(w * h, 4);
+		if (!po->static_buffer)
+			return -1;
+		po->static_image =
+			pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
+						 po->static_buffer, w * 4);
+		if (!po->static_image) {
+			free(po->static_buffer);
+			po->static_buffer = NULL;
+			return -1;
+		}
+	}
+
+	update_static_views(output, views, n);
+
+	/* Only what the views above do not cover opaquely shows. */
+	pixman_region32_init(&region);
+	pixman_region32_subtract(&region, damage, &views[n - 1]->clip);
+
+	pixman_region32_init(&redraw);
+	pixman_region32_intersect(&redraw, &po->static_damage, &region);
+	if (pixman_region32_not_empty(&redraw)) {
+		pixman_region32_subtract(&po->static_damage,
+					 &po->static_damage, &redraw);
+
+		/* Draw the static views into the cache instead, without
+		 * the clip of the views above, which may move away. */
+		pixman_region32_init(&no_clip);
+		shadow_image = po->shadow_image;
+		po->shadow_image = po->static_image;
+		for (i = 0; i < n; i++)
+			draw_view(views[i], output, &redraw, &no_clip);
+		po->shadow_image = shadow_image;
+		pixman_region32_fini(&no_clip);
+	}
+	pixman_region32_fini(&redraw);
+
+	region_global_to_output(output, &region);
+	pixman_image_set_clip_region32(po->shadow_image, &region);
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 po->static_image, /* src */
+				 NULL /* mask */,
+				 po->shadow_image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 pixman_image_get_width (po->shadow_image), /* width */
+				 pixman_image_get_height (po->shadow_image) /* height */);
+	pixman_image_set_clip_region32(po->shadow_image, NULL);
+	pixman_region32_fini(&region);
+
+	return 0;
+}
+
+/* Marks where the views of a static layer show the surface damage as
+ * stale in the caches of all outputs; all of each view if damage is
+ * NULL. */
+static void
+damage_static_views(struct weston_surface *surface,
+		    pixman_region32_t *damage) /* in surface coordinates */
+{
+	struct weston_output *output;
+	struct pixman_output_state *po;
+	struct weston_view *ev;
+	pixman_region32_t region;
+
+	wl_list_for_each(ev, &surface->views, surface_link) {
+		if (!view_is_static(ev))
+			continue;
+
+		pixman_region32_init(&region);
+		if (damage && !ev->transform.enabled) {
+			pixman_region32_copy(&region, damage);
+			pixman_region32_translate(&region,
+						  ev->geometry.x,
+						  ev->geometry.y);
+		} else {
+			pixman_region32_copy(&region,
+					     &ev->transform.boundingbox);
+		}
+
+		wl_list_for_each(output, &surface->compositor->output_list,
+				 link) {
+			po = get_output_state(output);
+			if (po)
+				pixman_region32_union(&po->static_damage,
+						      &po->static_damage,
+						      &region);
+		}
+		pixman_region32_fini(&region);
+	}
+}
+
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct weston_view **views = output->visible_views.data;
+	int i, n = 0, count = output->visible_views.size / sizeof *views;
+
+	/* The debug tint would be cached along. */
+	if (!pr->repaint_debug)
+		while (n < count && view_is_static(views[n]))
+			n++;
+
+	if (n > 0 && repaint_static_views(output, views, n, damage) < 0)
+		n = 0;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	for (i = n; i < count; i++)
+		draw_view(views[i], output, damage, &views[i]->clip);
 }
 
 static void
@@ -493,7 +670,8 @@ pixman_renderer_repaint_output(struct weston_output *output,
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	/* Nothing to upload, the buffer is used directly. */
+	damage_static_views(surface, &surface->damage);
 }
 
 static void
@@ -661,6 +839,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	}
 
 	ps->image = pixman_image_create_solid_fill(&color);
+
+	damage_static_views(es, NULL);
 }
 
 static void
@@ -773,6 +953,9 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	wl_array_init(&po->static_views);
+	pixman_region32_init(&po->static_damage);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -790,6 +973,12 @@ pixman_renderer_output_destroy(struct weston_output *output)
 
 	free(po->shadow_buffer);
 
+	if (po->static_image)
+		pixman_image_unref(po->static_image);
+	free(po->static_buffer);
+	wl_array_release(&po->static_views);
+	pixman_region32_fini(&po->static_damage);
+
 	po->shadow_buffer = NULL;
 	po->shadow_image = NULL;
 	po->hw_buffer = NULL;
@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _WESTON_REGION_UTIL_H_
+#define _WESTON_REGION_UTIL_H_
+
+#include <pixman.h>
+
+/* Box fast paths for the damage pipeline.
+ *
+ * A pixman_region32_t stores a single rectangle inline in its extents and
+ * only allocates rectangle storage once it holds two or more. Building an
+ * intermediate region just to test it for emptiness therefore allocates
+ * as soon as one of the operands is complex. These helpers answer the
+ * same questions for a box directly and never allocate.
+ */
+
+static inline int
+box_is_empty(const pixman_box32_t *box)
+{
+	return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+static inline int
+box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static inline int
+box_contains(const pixman_box32_t *outer, const pixman_box32_t *inner)
+{
+	return outer->x1 <= inner->x1 && outer->x2 >= inner->x2 &&
+	       outer->y1 <= inner->y1 && outer->y2 >= inner->y2;
+}
+
+/* Whether any part of box is inside region. */
+static inline int
+region_box_overlaps(pixman_region32_t *region, pixman_box32_t *box)
+{
+	if (box_is_empty(box) || !pixman_region32_not_empty(region))
+		return 0;
+
+	if (!box_overlaps(pixman_region32_extents(region), box))
+		return 0;
+
+	if (pixman_region32_n_rects(region) == 1)
+		return 1;
+
+	return pixman_region32_contains_rectangle(region, box) !=
+		PIXMAN_REGION_OUT;
+}
+
+/* Whether all of box is inside region. An empty box is always covered. */
+static inline int
+region_box_covered(pixman_region32_t *region, pixman_box32_t *box)
+{
+	if (box_is_empty(box))
+		return 1;
+
+	if (!box_contains(pixman_region32_extents(region), box))
+		return 0;
+
+	if (pixman_region32_n_rects(region) == 1)
+		return 1;
+
+	return pixman_region32_contains_rectangle(region, box) ==
+		PIXMAN_REGION_IN;
+}
+
+/* Whether some part of box inside damage is not covered by clip, i.e.
+ * whether drawing box clipped to damage minus clip touches any pixels.
+ * Answers conservatively (1) when only a full region operation could
+ * tell for sure.
+ */
+static inline int
+region_box_needs_repaint(pixman_region32_t *damage, pixman_region32_t *clip,
+			 pixman_box32_t *box)
+{
+	if (!region_box_overlaps(damage, box))
+		return 0;
+
+	return !region_box_covered(clip, box);
+}
+
+/* The region sequences of the damage pipeline, built on the helpers
+ * above. tests/region-bench.c runs them against the plain operations. */
+
+/* Adds damage minus opaque to plane_damage, for
+ * view_accumulate_damage(). damage is clobbered. */
+static inline void
+region_accumulate_damage(pixman_region32_t *plane_damage,
+			 pixman_region32_t *damage, pixman_region32_t *opaque)
+{
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+
+	if (pixman_region32_n_rects(damage) == 1 &&
+	    !region_box_overlaps(opaque, extents)) {
+		pixman_region32_union_rect(plane_damage, plane_damage,
+					   extents->x1, extents->y1,
+					   extents->x2 - extents->x1,
+					   extents->y2 - extents->y1);
+	} else if (!region_box_covered(opaque, extents)) {
+		pixman_region32_subtract(damage, damage, opaque);
+		pixman_region32_union(plane_damage, plane_damage, damage);
+	}
+}
+
+/* Sets clip to the opaque region of the views above, then adds the
+ * opaque region of the view itself to it. */
+static inline void
+region_accumulate_opaque(pixman_region32_t *clip, pixman_region32_t *opaque,
+			 pixman_region32_t *view_opaque)
+{
+	pixman_region32_copy(clip, opaque);
+	if (pixman_region32_not_empty(view_opaque))
+		pixman_region32_union(opaque, opaque, view_opaque);
+}
+
+/* Initializes repaint to the part of boundingbox inside damage and
+ * outside clip, for the renderers' draw_view(). Returns whether that is
+ * not empty. */
+static inline int
+region_init_repaint(pixman_region32_t *repaint,
+		    pixman_region32_t *boundingbox,
+		    pixman_region32_t *damage, pixman_region32_t *clip)
+{
+	pixman_region32_init(repaint);
+	if (!region_box_needs_repaint(damage, clip,
+				      pixman_region32_extents(boundingbox)))
+		return 0;
+
+	pixman_region32_intersect(repaint, boundingbox, damage);
+	pixman_region32_subtract(repaint, repaint, clip);
+
+	return pixman_region32_not_empty(repaint);
+}
+
+/* Initializes blend to the part of a width x height surface that opaque
+ * does not cover. */
+static inline void
+region_init_blend(pixman_region32_t *blend, int32_t width, int32_t height,
+		  pixman_region32_t *opaque)
+{
+	pixman_region32_init_rect(blend, 0, 0, width, height);
+	if (region_box_covered(opaque, pixman_region32_extents(blend)))
+		pixman_region32_clear(blend);
+	else if (pixman_region32_not_empty(opaque))
+		pixman_region32_subtract(blend, blend, opaque);
+}
+
+#endif
@@ -30,6 +30,7 @@
 #include "compositor.h"
 #include "launcher-util.h"
 #include "evdev.h"
+#include "evdev-thread.h"
 #include "udev-seat.h"
 
 static const char default_seat[] = "seat0";
@@ -79,7 +80,7 @@ device_added(struct udev_device *udev_device, struct udev_input *input)
 		return 0;
 	}
 
-	device = evdev_device_create(&seat->base, devnode, fd);
+	device = evdev_device_create(&seat->base, devnode, fd, input->thread);
 	if (device == EVDEV_UNHANDLED_DEVICE) {
 		weston_launcher_close(c->launcher, fd);
 		weston_log("not using input device '%s'.\n", devnode);
@@ -313,17 +314,29 @@ int
 udev_input_init(struct udev_input *input, struct weston_compositor *c, struct udev *udev,
 		const char *seat_id)
 {
+	struct weston_config_section *section;
+	int input_thread;
+
 	memset(input, 0, sizeof *input);
 	input->seat_id = strdup(seat_id);
 	input->compositor = c;
 	input->udev = udev;
 	input->udev = udev_ref(udev);
+
+	section = weston_config_get_section(c->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "input-thread",
+				       &input_thread, 0);
+	if (input_thread)
+		input->thread = evdev_thread_create(c);
+
 	if (udev_input_enable(input) < 0)
 		goto err;
 
 	return 0;
 
  err:
+	if (input->thread)
+		evdev_thread_destroy(input->thread);
 	free(input->seat_id);
 	return -1;
 }
@@ -333,6 +346,9 @@ udev_input_destroy(struct udev_input *input)
 {
 	struct udev_seat *seat, *next;
 	udev_input_disable(input);
+	if (input->thread)
+		evdev_thread_destroy(input->thread);
+	input->thread = NULL;
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	udev_unref(input->udev);
@@ -29,6 +29,8 @@
 
 #include "compositor.h"
 
+struct evdev_thread;
+
 struct udev_seat {
 	struct weston_seat base;
 	struct wl_list devices_list;
@@ -41,6 +43,7 @@ struct udev_input {
 	struct wl_event_source *udev_monitor_source;
 	char *seat_id;
 	struct weston_compositor *compositor;
+	struct evdev_thread *thread;
 	int enabled;
 };
 
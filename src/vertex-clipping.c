@@ -293,21 +293,50 @@ clip_simple(struct clip_context *ctx,
 	return surf->n;
 }
 
-int
-clip_transformed(struct clip_context *ctx,
-		 struct polygon8 *surf,
-		 float *ex,
-		 float *ey)
+/* The edges of the clip rectangle that vertices are outside of */
+enum clip_edge {
+	CLIP_EDGE_LEFT = 1 << 0,
+	CLIP_EDGE_RIGHT = 1 << 1,
+	CLIP_EDGE_TOP = 1 << 2,
+	CLIP_EDGE_BOTTOM = 1 << 3,
+};
+
+/* Classifies the vertices of surf against the four edges of the clip
+ * rectangle, with the same tests as the path_transition_*_edge(), by way
+ * of the bounding box of the vertices. Sets *any to the edges some vertex
+ * is outside of, and *all to the edges every vertex is outside of. */
+static void
+clip_polygon_outcodes(const struct clip_context *ctx,
+		      const struct polygon8 *surf, int *any, int *all)
 {
-	struct polygon8 polygon;
-	int i, n;
+	float min_x, min_y, max_x, max_y;
+	int i;
 
-	polygon.n = clip_polygon_left(ctx, surf, polygon.x, polygon.y);
-	surf->n = clip_polygon_right(ctx, &polygon, surf->x, surf->y);
-	polygon.n = clip_polygon_top(ctx, surf, polygon.x, polygon.y);
-	surf->n = clip_polygon_bottom(ctx, &polygon, surf->x, surf->y);
+	min_x = max_x = surf->x[0];
+	min_y = max_y = surf->y[0];
+	for (i = 1; i < surf->n; i++) {
+		min_x = min(min_x, surf->x[i]);
+		max_x = max(max_x, surf->x[i]);
+		min_y = min(min_y, surf->y[i]);
+		max_y = max(max_y, surf->y[i]);
+	}
+
+	*any = (min_x < ctx->clip.x1 ? CLIP_EDGE_LEFT : 0) |
+	       (max_x >= ctx->clip.x2 ? CLIP_EDGE_RIGHT : 0) |
+	       (min_y < ctx->clip.y1 ? CLIP_EDGE_TOP : 0) |
+	       (max_y >= ctx->clip.y2 ? CLIP_EDGE_BOTTOM : 0);
+	*all = (max_x < ctx->clip.x1 ? CLIP_EDGE_LEFT : 0) |
+	       (min_x >= ctx->clip.x2 ? CLIP_EDGE_RIGHT : 0) |
+	       (max_y < ctx->clip.y1 ? CLIP_EDGE_TOP : 0) |
+	       (min_y >= ctx->clip.y2 ? CLIP_EDGE_BOTTOM : 0);
+}
+
+/* Gets rid of duplicate vertices, from surf into (ex, ey) */
+static int
+clip_remove_duplicates(const struct polygon8 *surf, float *ex, float *ey)
+{
+	int i, n;
 
-	/* Get rid of duplicate vertices */
 	ex[0] = surf->x[0];
 	ey[0] = surf->y[0];
 	n = 1;
@@ -325,3 +354,68 @@ clip_transformed(struct clip_context *ctx,
 
 	return n;
 }
+
+/* A pass against an edge that every vertex is inside of gives back the
+ * polygon as it is, and a pass against an edge that every vertex is
+ * outside of leaves nothing, so only the edges that cross the polygon are
+ * clipped against. For a view that the damage rectangle covers, or misses
+ * entirely, that is none of them. */
+int
+clip_transformed(struct clip_context *ctx,
+		 struct polygon8 *surf,
+		 float *ex,
+		 float *ey)
+{
+	struct polygon8 polygon, *src = surf, *dst = &polygon;
+	struct polygon8 *tmp;
+	int any, all;
+
+	if (surf->n < 2) {
+		surf->n = 0;
+		return 0;
+	}
+
+	clip_polygon_outcodes(ctx, surf, &any, &all);
+	if (all) {
+		surf->n = 0;
+		return 0;
+	}
+
+	/* Ping-pong between polygon and surf, as the passes go. */
+	if (any & CLIP_EDGE_LEFT) {
+		dst->n = clip_polygon_left(ctx, src, dst->x, dst->y);
+		tmp = src, src = dst, dst = tmp;
+	}
+	if (any & CLIP_EDGE_RIGHT) {
+		dst->n = clip_polygon_right(ctx, src, dst->x, dst->y);
+		tmp = src, src = dst, dst = tmp;
+	}
+	if (any & CLIP_EDGE_TOP) {
+		dst->n = clip_polygon_top(ctx, src, dst->x, dst->y);
+		tmp = src, src = dst, dst = tmp;
+	}
+	if (any & CLIP_EDGE_BOTTOM) {
+		dst->n = clip_polygon_bottom(ctx, src, dst->x, dst->y);
+		src = dst;
+	}
+
+	return clip_remove_duplicates(src, ex, ey);
+}
+
+#ifdef UNIT_TEST
+int
+clip_transformed_scalar(struct clip_context *ctx,
+			struct polygon8 *surf,
+			float *ex,
+			float *ey)
+{
+	struct polygon8 polygon;
+
+	polygon.n = clip_polygon_left(ctx, surf, polygon.x, polygon.y);
+	surf->n = clip_polygon_right(ctx, &polygon, surf->x, surf->y);
+	polygon.n = clip_polygon_top(ctx, surf, polygon.x, polygon.y);
+	surf->n = clip_polygon_bottom(ctx, &polygon, surf->x, surf->y);
+
+	return clip_remove_duplicates(surf, ex, ey);
+}
+#endif
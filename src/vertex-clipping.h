@@ -58,6 +58,16 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
+
+#ifdef UNIT_TEST
+/* clip_transformed() against all four edges every time, as it was done
+ * before classifying the vertices first */
+int
+clip_transformed_scalar(struct clip_context *ctx,
+			struct polygon8 *surf,
+			float *ex,
+			float *ey);
+#endif
 
 #endif
@@ -27,7 +27,10 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "config-parser.h"
 
@@ -96,6 +99,112 @@ static const char t4[] =
 	"[bambam]\n"
 	"=not valid at all\n";
 
+/* Many sections of the same name, and repeated keys, parsed from the
+ * file and then from the parse cache, which has to be redone once the
+ * file changes. */
+static void
+check_outputs(struct weston_config *config, int count, const char *mode)
+{
+	struct weston_config_section *section;
+	char name[16], *s;
+	int i, r;
+
+	for (i = 0; i < count; i += 37) {
+		snprintf(name, sizeof name, "out%d", i);
+		section = weston_config_get_section(config, "output",
+						    "name", name);
+		assert(section);
+		r = weston_config_section_get_string(section, "mode", &s, NULL);
+		assert(r == 0 && strcmp(s, mode) == 0);
+		free(s);
+		r = weston_config_section_get_string(section, "seat", &s, NULL);
+		assert(r == 0 && strcmp(s, "first") == 0);
+		free(s);
+	}
+
+	section = weston_config_get_section(config, "output", "name", "none");
+	assert(section == NULL);
+}
+
+static void
+write_outputs(const char *path, int count, const char *mode)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	assert(fp);
+	for (i = 0; i < count; i++)
+		fprintf(fp, "[output]\nname=out%d\nmode=%s\n"
+			"seat=first\nseat=second\n", i, mode);
+	fclose(fp);
+}
+
+/* Finds the cache file in dir, or removes all files there with remove */
+static int
+find_cache(const char *dir, char *path, size_t size, int remove)
+{
+	struct dirent *de;
+	DIR *d;
+	int found = 0;
+
+	d = opendir(dir);
+	assert(d);
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, size, "%s/%s", dir, de->d_name);
+		if (remove)
+			unlink(path);
+		else if (strncmp(de->d_name, "weston-config-", 14) == 0) {
+			found = 1;
+			break;
+		}
+	}
+	closedir(d);
+
+	return found;
+}
+
+static void
+cache_test(const char *dir)
+{
+	struct weston_config *config;
+	char path[256], cache[512];
+	struct stat st;
+	int i;
+
+	snprintf(path, sizeof path, "%s/weston.ini", dir);
+	write_outputs(path, 500, "1920x1080");
+
+	/* Parsed, then mapped from the cache */
+	for (i = 0; i < 2; i++) {
+		config = weston_config_parse(path);
+		assert(config);
+		check_outputs(config, 500, "1920x1080");
+		weston_config_destroy(config);
+		assert(find_cache(dir, cache, sizeof cache, 0));
+	}
+
+	/* A changed file is parsed again */
+	write_outputs(path, 500, "800x600");
+	config = weston_config_parse(path);
+	assert(config);
+	check_outputs(config, 500, "800x600");
+	weston_config_destroy(config);
+
+	/* A cut short cache is not used */
+	assert(find_cache(dir, cache, sizeof cache, 0));
+	assert(stat(cache, &st) == 0);
+	assert(truncate(cache, st.st_size / 2) == 0);
+	config = weston_config_parse(path);
+	assert(config);
+	check_outputs(config, 500, "800x600");
+	weston_config_destroy(config);
+
+	find_cache(dir, cache, sizeof cache, 1);
+}
+
 int main(int argc, char *argv[])
 {
 	struct weston_config *config;
@@ -105,6 +214,13 @@ int main(int argc, char *argv[])
 	int r, b, i;
 	int32_t n;
 	uint32_t u;
+	char dir[] = "/tmp/weston-config-parser-test-XXXXXX", path[512];
+
+	/* Keep the parse caches of the test files out of the real
+	 * runtime dir */
+	assert(mkdtemp(dir));
+	setenv("XDG_RUNTIME_DIR", dir, 1);
+	cache_test(dir);
 
 	config = run_test(t0);
 	assert(config);
@@ -201,5 +317,8 @@ int main(int argc, char *argv[])
 	section = weston_config_get_section(NULL, "bucket", NULL, NULL);
 	assert(section == NULL);
 
+	find_cache(dir, path, sizeof path, 1);
+	rmdir(dir);
+
 	return 0;
 }
@@ -0,0 +1,361 @@
+/*
+ * Copyright © 2010 Intel Corporation
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Replays an event recording made with WESTON_EVDEV_RECORD=<dir> through
+ * the evdev input code, and reports how long the events took to process
+ * and to reach the client sockets. Load it into a headless compositor:
+ *
+ *   WESTON_EVDEV_REPLAY=event3.evrec weston --backend=headless-backend.so \
+ *	--modules=evdev-replay.so
+ *
+ * The events are replayed with their recorded timing, batched per timer
+ * wakeup like reads from the device would be. With WESTON_EVDEV_REPLAY_FAST
+ * set, each SYN_REPORT is processed as soon as the previous one is done.
+ * The compositor exits when the recording has been played.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "../src/compositor.h"
+#include "../src/evdev.h"
+
+struct evdev_replay {
+	struct weston_compositor *compositor;
+	struct weston_seat seat;
+	struct evdev_device *device;
+	struct wl_event_source *timer;
+	int fast;
+
+	struct input_event *events;
+	int count, next;
+
+	int64_t start_usec;		/* CLOCK_MONOTONIC */
+	int64_t first_event_usec;	/* recording time base */
+	struct rusage start_usage;
+
+	struct wl_array process_usec;	/* uint32_t per batch */
+	struct wl_array deliver_usec;	/* uint32_t per batch */
+	int64_t process_total_usec;
+	int batches;
+};
+
+static int64_t
+timeval_to_usec(const struct timeval *tv)
+{
+	return (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static int64_t
+get_usec(clockid_t clk_id)
+{
+	struct timespec ts;
+
+	clock_gettime(clk_id, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+load_recording(struct evdev_replay *replay, const char *path,
+	       struct evdev_device_caps *caps)
+{
+	struct evdev_record_header header;
+	long size;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		weston_log("evdev-replay: failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != EVDEV_RECORD_MAGIC ||
+	    header.version != EVDEV_RECORD_VERSION ||
+	    header.caps_size != sizeof *caps ||
+	    header.event_size != sizeof(struct input_event) ||
+	    fread(caps, sizeof *caps, 1, fp) != 1) {
+		weston_log("evdev-replay: %s is not an event recording "
+			   "of this machine\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp) - sizeof header - sizeof *caps;
+	fseek(fp, sizeof header + sizeof *caps, SEEK_SET);
+
+	replay->count = size / sizeof(struct input_event);
+	replay->events = malloc(replay->count * sizeof(struct input_event));
+	if (replay->count == 0 || replay->events == NULL ||
+	    fread(replay->events, sizeof(struct input_event),
+		  replay->count, fp) != (size_t) replay->count) {
+		weston_log("evdev-replay: no events in %s\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	replay->first_event_usec = timeval_to_usec(&replay->events[0].time);
+
+	return 0;
+}
+
+/* Returns the end of the batch of events starting at replay->next that is
+ * due at elapsed usecs into the replay, cut at a SYN_REPORT. */
+static int
+find_batch_end(struct evdev_replay *replay, int64_t elapsed)
+{
+	struct input_event *e;
+	int i, end = replay->next;
+
+	for (i = replay->next; i < replay->count; i++) {
+		e = &replay->events[i];
+		if (!replay->fast &&
+		    timeval_to_usec(&e->time) - replay->first_event_usec >
+		    elapsed)
+			break;
+
+		if (e->type == EV_SYN && e->code == SYN_REPORT) {
+			end = i + 1;
+			if (replay->fast)
+				break;
+		}
+	}
+
+	/* Trailing events without a SYN_REPORT */
+	if (i == replay->count)
+		end = replay->count;
+
+	return end;
+}
+
+static void
+replay_batch(struct evdev_replay *replay, int end)
+{
+	struct input_event *e;
+	int64_t offset, t0, t1, t2;
+	uint32_t *p;
+	int i;
+
+	/* Move the events into the present of the kernel's input clock,
+	 * CLOCK_REALTIME, keeping their spacing. */
+	offset = get_usec(CLOCK_REALTIME) -
+		timeval_to_usec(&replay->events[replay->next].time);
+	for (i = replay->next; i < end; i++) {
+		e = &replay->events[i];
+		t0 = timeval_to_usec(&e->time) + offset;
+		e->time.tv_sec = t0 / 1000000;
+		e->time.tv_usec = t0 % 1000000;
+	}
+
+	t0 = get_usec(CLOCK_MONOTONIC);
+	evdev_device_replay(replay->device, &replay->events[replay->next],
+			    end - replay->next);
+	t1 = get_usec(CLOCK_MONOTONIC);
+	wl_display_flush_clients(replay->compositor->wl_display);
+	t2 = get_usec(CLOCK_MONOTONIC);
+
+	p = wl_array_add(&replay->process_usec, sizeof *p);
+	if (p)
+		*p = t1 - t0;
+	p = wl_array_add(&replay->deliver_usec, sizeof *p);
+	if (p)
+		*p = t2 - t0;
+	replay->process_total_usec += t1 - t0;
+	replay->batches++;
+
+	replay->next = end;
+}
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+report_latency(const char *name, struct wl_array *array)
+{
+	uint32_t *v = array->data;
+	size_t n = array->size / sizeof *v;
+
+	if (n == 0)
+		return;
+
+	qsort(v, n, sizeof *v, compare_uint32);
+	weston_log("evdev-replay: %s per batch: "
+		   "min %u us, median %u us, 99%% %u us, max %u us\n",
+		   name, v[0], v[n / 2], v[n * 99 / 100], v[n - 1]);
+}
+
+static void
+replay_finish(struct evdev_replay *replay)
+{
+	struct rusage usage;
+	double seconds, cpu;
+
+	getrusage(RUSAGE_SELF, &usage);
+	seconds = (get_usec(CLOCK_MONOTONIC) - replay->start_usec) / 1e6;
+	cpu = (usage.ru_utime.tv_sec - replay->start_usage.ru_utime.tv_sec) +
+	      (usage.ru_stime.tv_sec - replay->start_usage.ru_stime.tv_sec) +
+	      1e-6 * (usage.ru_utime.tv_usec -
+		      replay->start_usage.ru_utime.tv_usec) +
+	      1e-6 * (usage.ru_stime.tv_usec -
+		      replay->start_usage.ru_stime.tv_usec);
+
+	weston_log("evdev-replay: %d events in %d batches over %.3f s, "
+		   "%.0f events/s, %.1f%% cpu\n",
+		   replay->count, replay->batches, seconds,
+		   replay->count / seconds, 100.0 * cpu / seconds);
+	weston_log("evdev-replay: processing %.2f us per event\n",
+		   (double) replay->process_total_usec / replay->count);
+	report_latency("processing", &replay->process_usec);
+	report_latency("event to client socket", &replay->deliver_usec);
+	if (replay->device->mt.motion_suppressed)
+		weston_log("evdev-replay: %llu touch motion events coalesced\n",
+			   (unsigned long long)
+			   replay->device->mt.motion_suppressed);
+
+	wl_display_terminate(replay->compositor->wl_display);
+}
+
+static void
+replay_idle_handler(void *data);
+
+static int
+replay_timer_handler(void *data)
+{
+	struct evdev_replay *replay = data;
+	struct wl_event_loop *loop;
+	int64_t elapsed, next_usec;
+	int end;
+
+	if (replay->start_usec == 0) {
+		replay->start_usec = get_usec(CLOCK_MONOTONIC);
+		getrusage(RUSAGE_SELF, &replay->start_usage);
+	}
+
+	elapsed = get_usec(CLOCK_MONOTONIC) - replay->start_usec;
+	end = find_batch_end(replay, elapsed);
+	if (end > replay->next)
+		replay_batch(replay, end);
+
+	if (replay->next == replay->count) {
+		replay_finish(replay);
+		return 0;
+	}
+
+	/* Let the compositor repaint and dispatch in between. */
+	if (replay->fast) {
+		loop = wl_display_get_event_loop(replay->compositor->wl_display);
+		wl_event_loop_add_idle(loop, replay_idle_handler, replay);
+		return 0;
+	}
+
+	/* Only the processed events have been moved to the present. */
+	next_usec = timeval_to_usec(&replay->events[replay->next].time) -
+		replay->first_event_usec;
+	wl_event_source_timer_update(replay->timer,
+				     next_usec > elapsed ?
+				     (next_usec - elapsed + 999) / 1000 : 1);
+
+	return 0;
+}
+
+static void
+replay_idle_handler(void *data)
+{
+	replay_timer_handler(data);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *ec,
+	    int *argc, char *argv[])
+{
+	struct evdev_replay *replay;
+	struct evdev_device_caps caps;
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+	const char *path;
+
+	path = getenv("WESTON_EVDEV_REPLAY");
+	if (!path) {
+		weston_log("evdev-replay: set WESTON_EVDEV_REPLAY to the "
+			   "recording to replay\n");
+		return -1;
+	}
+
+	replay = zalloc(sizeof *replay);
+	if (replay == NULL)
+		return -1;
+
+	replay->compositor = ec;
+	replay->fast = getenv("WESTON_EVDEV_REPLAY_FAST") != NULL;
+	wl_array_init(&replay->process_usec);
+	wl_array_init(&replay->deliver_usec);
+
+	if (load_recording(replay, path, &caps) < 0)
+		goto err;
+
+	weston_seat_init(&replay->seat, ec, "replay");
+	replay->device = evdev_device_create_replay(&replay->seat, path, &caps);
+	if (replay->device == NULL ||
+	    replay->device == EVDEV_UNHANDLED_DEVICE) {
+		weston_log("evdev-replay: cannot replay %s\n", caps.name);
+		weston_seat_release(&replay->seat);
+		goto err;
+	}
+
+	if (!wl_list_empty(&ec->output_list)) {
+		output = container_of(ec->output_list.next,
+				      struct weston_output, link);
+		evdev_device_set_output(replay->device, output);
+	}
+
+	weston_log("evdev-replay: replaying %d events of %s\n",
+		   replay->count, caps.name);
+
+	/* Give the shell client time to map its surfaces, so there is
+	 * someone to deliver the events to. */
+	loop = wl_display_get_event_loop(ec->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop, replay_timer_handler,
+						replay);
+	wl_event_source_timer_update(replay->timer, 1000);
+
+	return 0;
+
+err:
+	free(replay->events);
+	free(replay);
+	return -1;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2008 Kristian Høgsberg
+ * Copyright © 2012-2013 Collabora, Ltd.
+ * Copyright © 2013 Jason Ekstrand
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks that frame_repaint() draws the same pixels from its cache of the
+ * decoration as it does rendering the theme directly. The first repaint
+ * of a frame renders directly, the second one caches the decoration and
+ * draws from the cache, and the third one only draws from the cache.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "../shared/cairo-util.h"
+
+#define FRAME_WIDTH	400
+#define FRAME_HEIGHT	300
+
+struct frame_cache_test_data {
+	const char *name;
+	uint32_t flags;
+	double scale;
+	double angle;
+};
+
+static const struct frame_cache_test_data test_data[] = {
+	{ "active", FRAME_FLAG_ACTIVE, 1, 0 },
+	{ "inactive", 0, 1, 0 },
+	{ "maximized", FRAME_FLAG_ACTIVE | FRAME_FLAG_MAXIMIZED, 1, 0 },
+	{ "buffer scale 2", FRAME_FLAG_ACTIVE, 2, 0 },
+	{ "rotated", FRAME_FLAG_ACTIVE, 1, 0.3 },
+	{ "rotated by 90 degrees", 0, 1, M_PI / 2 },
+};
+
+/* Repaints the frame over an opaque background, scaled and rotated
+ * about the middle of the surface. */
+static void
+repaint(struct frame *frame, cairo_surface_t *surface,
+	const struct frame_cache_test_data *tdata)
+{
+	cairo_t *cr;
+
+	cr = cairo_create(surface);
+	cairo_set_source_rgb(cr, 1, 0, 1);
+	cairo_paint(cr);
+
+	cairo_translate(cr, cairo_image_surface_get_width(surface) / 2,
+			cairo_image_surface_get_height(surface) / 2);
+	cairo_rotate(cr, tdata->angle);
+	cairo_scale(cr, tdata->scale, tdata->scale);
+	cairo_translate(cr, -frame_width(frame) / 2, -frame_height(frame) / 2);
+	frame_repaint(frame, cr);
+	assert(cairo_status(cr) == CAIRO_STATUS_SUCCESS);
+	cairo_destroy(cr);
+
+	cairo_surface_flush(surface);
+}
+
+/* Returns the number of pixels that differ, and prints the first one. */
+static int
+compare(cairo_surface_t *a, cairo_surface_t *b, const char *name)
+{
+	int width = cairo_image_surface_get_width(a);
+	int height = cairo_image_surface_get_height(a);
+	int stride = cairo_image_surface_get_stride(a);
+	uint32_t *pa, *pb;
+	int x, y, count = 0;
+
+	for (y = 0; y < height; y++) {
+		pa = (uint32_t *) (cairo_image_surface_get_data(a) + y * stride);
+		pb = (uint32_t *) (cairo_image_surface_get_data(b) + y * stride);
+		for (x = 0; x < width; x++) {
+			if (pa[x] == pb[x])
+				continue;
+			if (count++ == 0)
+				fprintf(stderr, "%s: pixel %d,%d is %08x "
+					"drawn directly, %08x from the cache\n",
+					name, x, y, pa[x], pb[x]);
+		}
+	}
+
+	return count;
+}
+
+TEST_P(frame_cache_matches_direct_rendering, test_data)
+{
+	const struct frame_cache_test_data *tdata = data;
+	cairo_surface_t *surface[3];
+	struct theme *theme;
+	struct frame *frame;
+	int size, i;
+
+	theme = theme_create();
+	assert(theme);
+	frame = frame_create(theme, FRAME_WIDTH, FRAME_HEIGHT,
+			     FRAME_BUTTON_ALL, "frame cache test");
+	assert(frame);
+	if (tdata->flags & FRAME_FLAG_ACTIVE)
+		frame_set_flag(frame, FRAME_FLAG_ACTIVE);
+	if (tdata->flags & FRAME_FLAG_MAXIMIZED)
+		frame_set_flag(frame, FRAME_FLAG_MAXIMIZED);
+
+	/* Room for the frame at any angle */
+	size = (FRAME_WIDTH + FRAME_HEIGHT) * tdata->scale;
+	for (i = 0; i < 3; i++) {
+		surface[i] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+							size, size);
+		repaint(frame, surface[i], tdata);
+	}
+
+	assert(compare(surface[0], surface[1], tdata->name) == 0);
+	assert(compare(surface[0], surface[2], tdata->name) == 0);
+
+	for (i = 0; i < 3; i++)
+		cairo_surface_destroy(surface[i]);
+	frame_destroy(frame);
+	theme_destroy(theme);
+}
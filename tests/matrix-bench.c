@@ -0,0 +1,310 @@
+/*
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times weston_matrix_multiply(), weston_matrix_transform() and
+ * weston_matrix_invert() on the kinds of matrices views carry, against
+ * the plain 4x4 versions they specialize, and checks that both give the
+ * same results. Also times transforming the four corners of a bounding
+ * box with weston_matrix_transform_points() against one by one.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../shared/matrix.h"
+
+#define ITERATIONS	2000000
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* The generic versions, as weston_matrix_*() were before specializing */
+
+static void __attribute__((noinline))
+plain_multiply(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	struct weston_matrix tmp;
+	const float *row, *column;
+	div_t d;
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		tmp.d[i] = 0;
+		d = div(i, 4);
+		row = m->d + d.quot * 4;
+		column = n->d + d.rem;
+		for (j = 0; j < 4; j++)
+			tmp.d[i] += row[j] * column[j * 4];
+	}
+	tmp.type = m->type | n->type;
+	memcpy(m, &tmp, sizeof tmp);
+}
+
+static void __attribute__((noinline))
+plain_transform(struct weston_matrix *matrix, struct weston_vector *v)
+{
+	int i, j;
+	struct weston_vector t;
+
+	for (i = 0; i < 4; i++) {
+		t.f[i] = 0;
+		for (j = 0; j < 4; j++)
+			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+	}
+
+	*v = t;
+}
+
+static int __attribute__((noinline))
+plain_invert(struct weston_matrix *inverse,
+	     const struct weston_matrix *matrix)
+{
+	double LU[16];
+	unsigned perm[4];
+	unsigned c;
+
+	if (matrix_invert(LU, perm, matrix) < 0)
+		return -1;
+
+	weston_matrix_init(inverse);
+	for (c = 0; c < 4; ++c)
+		inverse_transform(LU, perm, &inverse->d[c * 4]);
+	inverse->type = matrix->type;
+
+	return 0;
+}
+
+/* The corners of a box, one at a time, as view_compute_bbox() did */
+static void __attribute__((noinline))
+plain_transform_points(struct weston_matrix *matrix, float *p, int n)
+{
+	struct weston_vector v;
+	int i;
+
+	for (i = 0; i < n * 2; i += 2) {
+		v.f[0] = p[i];
+		v.f[1] = p[i + 1];
+		v.f[2] = 0;
+		v.f[3] = 1;
+		plain_transform(matrix, &v);
+		p[i] = v.f[0] / v.f[3];
+		p[i + 1] = v.f[1] / v.f[3];
+	}
+}
+
+static const float box[8] = { 0, 0,  0, 480,  640, 0,  640, 480 };
+
+static void
+make_identity(struct weston_matrix *m)
+{
+	weston_matrix_init(m);
+}
+
+static void
+make_translate(struct weston_matrix *m)
+{
+	weston_matrix_init(m);
+	weston_matrix_translate(m, 312, 207, 0);
+}
+
+/* A surface scaled about its center, like the zoom and fade animations */
+static void
+make_scale(struct weston_matrix *m)
+{
+	weston_matrix_init(m);
+	weston_matrix_translate(m, -320, -240, 0);
+	weston_matrix_scale(m, 0.8, 0.8, 1);
+	weston_matrix_translate(m, 632, 447, 0);
+}
+
+/* A window rotated about its center, like the desktop-shell rotate
+ * binding does */
+static void
+make_rotate(struct weston_matrix *m)
+{
+	weston_matrix_init(m);
+	weston_matrix_translate(m, -320, -240, 0);
+	weston_matrix_rotate_xy(m, cos(0.3), sin(0.3));
+	weston_matrix_translate(m, 632, 447, 0);
+}
+
+/* A perspective projection, like the cube in the zoom output matrix */
+static void
+make_other(struct weston_matrix *m)
+{
+	make_rotate(m);
+	m->d[3] = 0.0005;
+	m->d[7] = -0.0002;
+	m->type |= WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+static double
+max_error(const float *a, const float *b, int n)
+{
+	double err, errsup = 0.0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		err = fabs(a[i] - b[i]) / (1.0 + fabs(b[i]));
+		if (err > errsup)
+			errsup = err;
+	}
+
+	return errsup;
+}
+
+static int
+run(const char *name, void (*make)(struct weston_matrix *m))
+{
+	struct weston_matrix m, n, r, s;
+	struct weston_vector v, w;
+	float p[8], q[8];
+	double t[8], err[4];
+	int i;
+
+	make(&m);
+	make_translate(&n);
+
+	/* Check that the results agree */
+	r = m;
+	s = m;
+	weston_matrix_multiply(&r, &n);
+	plain_multiply(&s, &n);
+	err[0] = max_error(r.d, s.d, 16);
+
+	v.f[0] = w.f[0] = 100;
+	v.f[1] = w.f[1] = 50;
+	v.f[2] = w.f[2] = 0;
+	v.f[3] = w.f[3] = 1;
+	weston_matrix_transform(&m, &v);
+	plain_transform(&m, &w);
+	err[1] = max_error(v.f, w.f, 4);
+
+	if (weston_matrix_invert(&r, &m) < 0 || plain_invert(&s, &m) < 0)
+		err[2] = INFINITY;
+	else
+		err[2] = max_error(r.d, s.d, 16);
+
+	memcpy(p, box, sizeof p);
+	memcpy(q, box, sizeof q);
+	weston_matrix_transform_points(&m, p, p, 4);
+	plain_transform_points(&m, q, 4);
+	err[3] = max_error(p, q, 8);
+
+	/* And time them */
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++) {
+		r = m;
+		weston_matrix_multiply(&r, &n);
+	}
+	t[0] = read_timer();
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++) {
+		r = m;
+		plain_multiply(&r, &n);
+	}
+	t[1] = read_timer();
+
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++)
+		weston_matrix_transform(&m, &v);
+	t[2] = read_timer();
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++)
+		plain_transform(&m, &w);
+	t[3] = read_timer();
+
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++)
+		weston_matrix_invert(&r, &m);
+	t[4] = read_timer();
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++)
+		plain_invert(&s, &m);
+	t[5] = read_timer();
+
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++) {
+		memcpy(p, box, sizeof p);
+		weston_matrix_transform_points(&m, p, p, 4);
+	}
+	t[6] = read_timer();
+	reset_timer();
+	for (i = 0; i < ITERATIONS; i++) {
+		memcpy(q, box, sizeof q);
+		plain_transform_points(&m, q, 4);
+	}
+	t[7] = read_timer();
+
+	printf("%-10s multiply %5.1f ns (plain %5.1f), "
+	       "transform %5.1f ns (plain %5.1f), "
+	       "invert %5.1f ns (plain %5.1f), "
+	       "box %5.1f ns (plain %5.1f)\n", name,
+	       1e9 * t[0] / ITERATIONS, 1e9 * t[1] / ITERATIONS,
+	       1e9 * t[2] / ITERATIONS, 1e9 * t[3] / ITERATIONS,
+	       1e9 * t[4] / ITERATIONS, 1e9 * t[5] / ITERATIONS,
+	       1e9 * t[6] / ITERATIONS, 1e9 * t[7] / ITERATIONS);
+
+	for (i = 0; i < 4; i++) {
+		if (err[i] > 1e-5) {
+			printf("%-10s results differ, errors %g %g %g %g\n",
+			       name, err[0], err[1], err[2], err[3]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret |= run("identity", make_identity);
+	ret |= run("translate", make_translate);
+	ret |= run("scale", make_scale);
+	ret |= run("rotate", make_rotate);
+	ret |= run("other", make_other);
+
+	return ret;
+}
@@ -179,6 +179,17 @@ randomize_matrix(struct weston_matrix *m)
 #else
 		m->d[i] = frand();
 #endif
+	/* Full matrix, so weston_matrix_invert() takes no shortcut */
+	m->type = WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+/* A random matrix that is far enough from singular for the speed tests */
+static void
+randomize_invertible_matrix(struct weston_matrix *m)
+{
+	do
+		randomize_matrix(m);
+	while (fabs(determinant(m)) < 1e-5);
 }
 
 /* Take a matrix, compute inverse, multiply together
@@ -271,19 +282,20 @@ static void __attribute__((noinline))
 test_loop_speed_matrixvector(void)
 {
 	struct weston_matrix m;
-	struct weston_vector v = { { 0.5, 0.5, 0.5, 1.0 } };
+	struct weston_vector v = { { 0.5, 0.5, 0.5, 1.0 } }, w;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on weston_matrix_transform()...\n");
 
-	weston_matrix_init(&m);
+	randomize_invertible_matrix(&m);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
-		weston_matrix_transform(&m, &v);
+		w = v;
+		weston_matrix_transform(&m, &w);
 		count++;
 	}
 	t = read_timer();
@@ -303,7 +315,7 @@ test_loop_speed_inversetransform(void)
 
 	printf("\nRunning 3 s test on inverse_transform()...\n");
 
-	weston_matrix_init(&m);
+	randomize_invertible_matrix(&m);
 	matrix_invert(inv.LU, inv.perm, &m);
 
 	running = 1;
@@ -329,7 +341,7 @@ test_loop_speed_invert(void)
 
 	printf("\nRunning 3 s test on matrix_invert()...\n");
 
-	weston_matrix_init(&m);
+	randomize_invertible_matrix(&m);
 
 	running = 1;
 	alarm(3);
@@ -347,19 +359,19 @@ test_loop_speed_invert(void)
 static void __attribute__((noinline))
 test_loop_speed_invert_explicit(void)
 {
-	struct weston_matrix m;
+	struct weston_matrix m, inv;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on weston_matrix_invert()...\n");
 
-	weston_matrix_init(&m);
+	randomize_invertible_matrix(&m);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
-		weston_matrix_invert(&m, &m);
+		weston_matrix_invert(&inv, &m);
 		count++;
 	}
 	t = read_timer();
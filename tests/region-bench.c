@@ -0,0 +1,544 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ * Copyright © 2012 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times the box helpers of region-util.h against the region operations
+ * they replace in the damage pipeline, on regions shaped like a stack of
+ * overlapping windows, and checks that both give the same answers.
+ *
+ * Then runs the region work of a frame with 200 stacked views: the
+ * damage and opaque accumulation of compositor_accumulate_damage() and
+ * the repaint and blend regions of the pixman renderer's draw_view(),
+ * once with the plain region operations they used before and once with
+ * the region-util.h sequences they use now. Counts every allocation the
+ * frame makes, including those inside libpixman, by interposing malloc.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/region-util.h"
+
+#define NUM_WINDOWS	32
+#define NUM_BOXES	64
+#define NUM_ROUNDS	2000
+#define OUTPUT_WIDTH	1920
+#define OUTPUT_HEIGHT	1080
+#define WINDOW_WIDTH	480
+#define WINDOW_HEIGHT	360
+
+#define NUM_VIEWS	200
+#define NUM_FRAMES	2000
+#define SHADOW		16
+
+/* Count every allocation, including the ones made inside libpixman. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+
+void *
+malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+enum region_kind {
+	REGION_SIMPLE,
+	REGION_COMPLEX,
+	REGION_EMPTY,
+	REGION_KIND_COUNT
+};
+
+static const char *region_names[] = {
+	"single rectangle",
+	"window stack",
+	"empty",
+};
+
+static pixman_region32_t regions[REGION_KIND_COUNT];
+static pixman_box32_t boxes[NUM_BOXES];
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* The regions: a damage rectangle, the opaque region of a stack of
+ * staggered windows as compositor_accumulate_damage() builds it, and
+ * nothing. The boxes are window bounding boxes across the output, some
+ * inside either region, some partly and some outside. */
+static void
+setup(void)
+{
+	pixman_box32_t *box;
+	int i, x, y;
+
+	pixman_region32_init_rect(&regions[REGION_SIMPLE], 200, 150,
+				  WINDOW_WIDTH, WINDOW_HEIGHT);
+
+	pixman_region32_init(&regions[REGION_COMPLEX]);
+	for (i = 0; i < NUM_WINDOWS; i++) {
+		x = (i * 97) % (OUTPUT_WIDTH - WINDOW_WIDTH);
+		y = (i * 61) % (OUTPUT_HEIGHT - WINDOW_HEIGHT);
+		pixman_region32_union_rect(&regions[REGION_COMPLEX],
+					   &regions[REGION_COMPLEX],
+					   x, y, WINDOW_WIDTH, WINDOW_HEIGHT);
+	}
+
+	pixman_region32_init(&regions[REGION_EMPTY]);
+
+	for (i = 0; i < NUM_BOXES; i++) {
+		box = &boxes[i];
+		box->x1 = (i * 151) % OUTPUT_WIDTH - WINDOW_WIDTH / 2;
+		box->y1 = (i * 89) % OUTPUT_HEIGHT - WINDOW_HEIGHT / 2;
+		box->x2 = box->x1 + WINDOW_WIDTH / (1 + i % 4);
+		box->y2 = box->y1 + WINDOW_HEIGHT / (1 + i % 3);
+	}
+}
+
+static void
+teardown(void)
+{
+	int i;
+
+	for (i = 0; i < REGION_KIND_COUNT; i++)
+		pixman_region32_fini(&regions[i]);
+}
+
+/* The region operations the helpers stand in for */
+
+static int
+plain_overlaps(pixman_region32_t *region, pixman_box32_t *box)
+{
+	pixman_region32_t r;
+	int ret;
+
+	pixman_region32_init_rect(&r, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_intersect(&r, &r, region);
+	ret = pixman_region32_not_empty(&r);
+	pixman_region32_fini(&r);
+
+	return ret;
+}
+
+static int
+plain_covered(pixman_region32_t *region, pixman_box32_t *box)
+{
+	pixman_region32_t r;
+	int ret;
+
+	pixman_region32_init_rect(&r, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_subtract(&r, &r, region);
+	ret = !pixman_region32_not_empty(&r);
+	pixman_region32_fini(&r);
+
+	return ret;
+}
+
+static int
+plain_needs_repaint(pixman_region32_t *damage, pixman_region32_t *clip,
+		    pixman_box32_t *box)
+{
+	pixman_region32_t r;
+	int ret;
+
+	pixman_region32_init_rect(&r, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	pixman_region32_intersect(&r, &r, damage);
+	pixman_region32_subtract(&r, &r, clip);
+	ret = pixman_region32_not_empty(&r);
+	pixman_region32_fini(&r);
+
+	return ret;
+}
+
+static int
+box_question(int question, pixman_region32_t *region, pixman_box32_t *box,
+	     int fast)
+{
+	pixman_region32_t *clip = &regions[REGION_SIMPLE];
+
+	switch (question) {
+	case 0:
+		return fast ? region_box_overlaps(region, box) :
+			plain_overlaps(region, box);
+	case 1:
+		return fast ? region_box_covered(region, box) :
+			plain_covered(region, box);
+	default:
+		return fast ? region_box_needs_repaint(region, clip, box) :
+			plain_needs_repaint(region, clip, box);
+	}
+}
+
+static const char *question_names[] = {
+	"region_box_overlaps",
+	"region_box_covered",
+	"region_box_needs_repaint",
+};
+
+static double
+run(int question, pixman_region32_t *region, int fast, int *answers)
+{
+	volatile int sink = 0;
+	double t;
+	int i, j;
+
+	for (j = 0; j < NUM_BOXES; j++)
+		answers[j] = box_question(question, region, &boxes[j], fast);
+
+	reset_timer();
+	for (i = 0; i < NUM_ROUNDS; i++)
+		for (j = 0; j < NUM_BOXES; j++)
+			sink += box_question(question, region,
+					     &boxes[j], fast);
+	t = read_timer();
+
+	return 1e9 * t / (NUM_ROUNDS * NUM_BOXES);
+}
+
+/* The frame */
+
+struct bench_view {
+	int32_t x, y;
+	pixman_region32_t damage;		/* surface coordinates */
+	pixman_region32_t opaque;		/* surface coordinates */
+	pixman_region32_t boundingbox;		/* global */
+	pixman_region32_t masked_opaque;	/* global */
+	pixman_region32_t clip;
+};
+
+static struct bench_view views[NUM_VIEWS];	/* top first */
+static pixman_region32_t plane_damage;
+static pixman_region32_t output_region;
+
+/* Decorated windows with an opaque inside, every tenth one translucent
+ * and every seventh one fully opaque, staggered across the output. */
+static void
+setup_views(void)
+{
+	struct bench_view *v;
+	int i;
+
+	for (i = 0; i < NUM_VIEWS; i++) {
+		v = &views[i];
+		v->x = (i * 37) % (OUTPUT_WIDTH - WINDOW_WIDTH);
+		v->y = (i * 23) % (OUTPUT_HEIGHT - WINDOW_HEIGHT);
+
+		pixman_region32_init(&v->damage);
+		if (i % 10 == 9)
+			pixman_region32_init(&v->opaque);
+		else if (i % 7 == 6)
+			pixman_region32_init_rect(&v->opaque, 0, 0,
+						  WINDOW_WIDTH, WINDOW_HEIGHT);
+		else
+			pixman_region32_init_rect(&v->opaque, SHADOW, SHADOW,
+						  WINDOW_WIDTH - 2 * SHADOW,
+						  WINDOW_HEIGHT - 2 * SHADOW);
+		pixman_region32_init_rect(&v->boundingbox, v->x, v->y,
+					  WINDOW_WIDTH, WINDOW_HEIGHT);
+		pixman_region32_init(&v->masked_opaque);
+		pixman_region32_copy(&v->masked_opaque, &v->opaque);
+		pixman_region32_translate(&v->masked_opaque, v->x, v->y);
+		pixman_region32_init(&v->clip);
+	}
+
+	pixman_region32_init(&plane_damage);
+	pixman_region32_init_rect(&output_region, 0, 0,
+				  OUTPUT_WIDTH, OUTPUT_HEIGHT);
+}
+
+static void
+teardown_views(void)
+{
+	struct bench_view *v;
+	int i;
+
+	for (i = 0; i < NUM_VIEWS; i++) {
+		v = &views[i];
+		pixman_region32_fini(&v->damage);
+		pixman_region32_fini(&v->opaque);
+		pixman_region32_fini(&v->boundingbox);
+		pixman_region32_fini(&v->masked_opaque);
+		pixman_region32_fini(&v->clip);
+	}
+
+	pixman_region32_fini(&plane_damage);
+	pixman_region32_fini(&output_region);
+}
+
+/* A client animating a small area of the top window, a client updating
+ * two areas of a window halfway down the stack, and a cursor-sized
+ * update of a window near the bottom. */
+static void
+damage_views(int frame)
+{
+	struct bench_view *v;
+
+	v = &views[0];
+	pixman_region32_union_rect(&v->damage, &v->damage,
+				   SHADOW + frame % 200, SHADOW + 40, 64, 64);
+	v = &views[NUM_VIEWS / 2];
+	pixman_region32_union_rect(&v->damage, &v->damage,
+				   SHADOW, SHADOW, 100, 50);
+	pixman_region32_union_rect(&v->damage, &v->damage,
+				   SHADOW + 200, SHADOW + 200, 100, 50);
+	v = &views[NUM_VIEWS - 3];
+	pixman_region32_union_rect(&v->damage, &v->damage,
+				   SHADOW + frame % 64, SHADOW, 24, 24);
+}
+
+/* view_accumulate_damage() and draw_view() as they were, for the
+ * untransformed views here */
+
+static void
+accumulate_plain(struct bench_view *v, pixman_region32_t *opaque)
+{
+	pixman_region32_t damage;
+
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &v->damage);
+	pixman_region32_translate(&damage, v->x, v->y);
+	pixman_region32_subtract(&damage, &damage, opaque);
+	pixman_region32_union(&plane_damage, &plane_damage, &damage);
+	pixman_region32_fini(&damage);
+	pixman_region32_copy(&v->clip, opaque);
+	pixman_region32_union(opaque, opaque, &v->masked_opaque);
+}
+
+static int
+draw_plain(struct bench_view *v, pixman_region32_t *damage)
+{
+	pixman_region32_t repaint, surface_blend;
+	int painted = 0;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint, &v->boundingbox, damage);
+	pixman_region32_subtract(&repaint, &repaint, &v->clip);
+
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	pixman_region32_init_rect(&surface_blend, 0, 0,
+				  WINDOW_WIDTH, WINDOW_HEIGHT);
+	pixman_region32_subtract(&surface_blend, &surface_blend, &v->opaque);
+	painted = 1 + pixman_region32_n_rects(&surface_blend);
+	pixman_region32_fini(&surface_blend);
+
+out:
+	pixman_region32_fini(&repaint);
+
+	return painted;
+}
+
+/* And as they are now */
+
+static void
+accumulate_fast(struct bench_view *v, pixman_region32_t *opaque)
+{
+	pixman_region32_t damage;
+
+	if (!pixman_region32_not_empty(&v->damage))
+		goto clip;
+
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &v->damage);
+	pixman_region32_translate(&damage, v->x, v->y);
+	region_accumulate_damage(&plane_damage, &damage, opaque);
+	pixman_region32_fini(&damage);
+
+clip:
+	region_accumulate_opaque(&v->clip, opaque, &v->masked_opaque);
+}
+
+static int
+draw_fast(struct bench_view *v, pixman_region32_t *damage)
+{
+	pixman_region32_t repaint, surface_blend;
+	int painted = 0;
+
+	if (!region_init_repaint(&repaint, &v->boundingbox, damage, &v->clip))
+		goto out;
+
+	region_init_blend(&surface_blend, WINDOW_WIDTH, WINDOW_HEIGHT,
+			  &v->opaque);
+	painted = 1 + pixman_region32_n_rects(&surface_blend);
+	pixman_region32_fini(&surface_blend);
+
+out:
+	pixman_region32_fini(&repaint);
+
+	return painted;
+}
+
+/* Returns a sum over the views drawn, for comparing the two. */
+static int
+run_frame(int frame, int fast, pixman_region32_t *output_damage)
+{
+	pixman_region32_t opaque;
+	int i, painted = 0;
+
+	damage_views(frame);
+
+	pixman_region32_init(&opaque);
+	for (i = 0; i < NUM_VIEWS; i++) {
+		if (fast)
+			accumulate_fast(&views[i], &opaque);
+		else
+			accumulate_plain(&views[i], &opaque);
+	}
+	pixman_region32_fini(&opaque);
+
+	pixman_region32_intersect(output_damage,
+				  &plane_damage, &output_region);
+
+	for (i = NUM_VIEWS - 1; i >= 0; i--) {
+		if (fast)
+			painted += draw_fast(&views[i], output_damage) * i;
+		else
+			painted += draw_plain(&views[i], output_damage) * i;
+	}
+
+	pixman_region32_subtract(&plane_damage, &plane_damage, output_damage);
+
+	for (i = 0; i < NUM_VIEWS; i++)
+		pixman_region32_clear(&views[i].damage);
+
+	return painted;
+}
+
+static int
+run_frames(void)
+{
+	static const char *names[] = { "plain", "region-util.h" };
+	pixman_region32_t damage[2];
+	unsigned long start;
+	int painted[2];
+	double t;
+	int fast, i, errors = 0;
+
+	for (fast = 0; fast < 2; fast++) {
+		pixman_region32_init(&damage[fast]);
+
+		/* Warm up, so the persistent regions have grown to size. */
+		for (i = 0; i < 10; i++)
+			run_frame(i, fast, &damage[fast]);
+
+		start = alloc_count;
+		reset_timer();
+		for (i = 0; i < NUM_FRAMES; i++)
+			painted[fast] = run_frame(i, fast, &damage[fast]);
+		t = read_timer();
+
+		printf("frame of %d views, %-13s %6.1f allocations, "
+		       "%6.1f us\n", NUM_VIEWS, names[fast],
+		       (double) (alloc_count - start) / NUM_FRAMES,
+		       1e6 * t / NUM_FRAMES);
+	}
+
+	if (painted[0] != painted[1] ||
+	    !pixman_region32_equal(&damage[0], &damage[1])) {
+		printf("  frames differ: drew %d, %d\n",
+		       painted[0], painted[1]);
+		errors++;
+	}
+
+	for (fast = 0; fast < 2; fast++)
+		pixman_region32_fini(&damage[fast]);
+
+	return errors;
+}
+
+int main(void)
+{
+	int plain[NUM_BOXES], fast[NUM_BOXES];
+	double plain_ns, fast_ns;
+	int question, kind, j, errors = 0;
+
+	setup();
+
+	for (question = 0; question < 3; question++) {
+		for (kind = 0; kind < REGION_KIND_COUNT; kind++) {
+			plain_ns = run(question, &regions[kind], 0, plain);
+			fast_ns = run(question, &regions[kind], 1, fast);
+
+			printf("%-24s %-16s plain %6.1f ns, helper %6.1f ns\n",
+			       question_names[question], region_names[kind],
+			       plain_ns, fast_ns);
+
+			/* region_box_needs_repaint() may answer 1
+			 * conservatively, the others must be exact */
+			for (j = 0; j < NUM_BOXES; j++) {
+				if (fast[j] == plain[j] ||
+				    (question == 2 && fast[j]))
+					continue;
+				printf("  box %d: helper %d, region ops %d\n",
+				       j, fast[j], plain[j]);
+				errors++;
+			}
+		}
+	}
+
+	teardown();
+
+	setup_views();
+	errors += run_frames();
+	teardown_views();
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
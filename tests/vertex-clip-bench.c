@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2013 Sam Spilsbury <smspillaz@gmail.com>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times clip_transformed() against clip_transformed_scalar() on a rotated
+ * window clipped to a grid of damage rectangles, the way the GL renderer
+ * clips transformed views, and checks that both give the same polygons.
+ * A grid of 1 is a full repaint, where the damage covers the window; the
+ * finer grids are the damage of small updates.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/vertex-clipping.h"
+
+#define ITERATIONS	200000
+#define REPEATS		5
+#define MAX_GRID	16
+
+typedef int (*clip_func_t)(struct clip_context *ctx, struct polygon8 *surf,
+			   float *ex, float *ey);
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* A 640x480 window rotated by angle about (632, 447) */
+static void
+make_window(struct polygon8 *surf, float angle)
+{
+	static const float corners[4][2] = {
+		{ -320, -240 }, { 320, -240 }, { 320, 240 }, { -320, 240 }
+	};
+	float c = cos(angle), s = sin(angle);
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		surf->x[i] = 632 + c * corners[i][0] - s * corners[i][1];
+		surf->y[i] = 447 + s * corners[i][0] + c * corners[i][1];
+	}
+	surf->n = 4;
+}
+
+/* Clips the window to each rectangle of a grid x grid split of the
+ * 1280x900 area around it, and returns the vertex count. */
+static int
+clip_grid(clip_func_t func, const struct polygon8 *window, int grid,
+	  float *out)
+{
+	struct clip_context ctx;
+	struct polygon8 surf;
+	float ex[8], ey[8];
+	int i, j, k, n, total = 0;
+
+	for (j = 0; j < grid; j++) {
+		for (i = 0; i < grid; i++) {
+			ctx.clip.x1 = i * 1280 / grid;
+			ctx.clip.y1 = j * 900 / grid;
+			ctx.clip.x2 = (i + 1) * 1280 / grid;
+			ctx.clip.y2 = (j + 1) * 900 / grid;
+			surf = *window;
+			n = func(&ctx, &surf, ex, ey);
+			if (out) {
+				for (k = 0; k < n; k++) {
+					*out++ = ex[k];
+					*out++ = ey[k];
+				}
+			}
+			total += n;
+		}
+	}
+
+	return total;
+}
+
+static int
+run(float angle, int grid)
+{
+	static float p[MAX_GRID * MAX_GRID * 16], q[MAX_GRID * MAX_GRID * 16];
+	int iterations = ITERATIONS / (grid * grid);
+	struct polygon8 window;
+	double t[2], err, errsup = 0.0;
+	int n, m, i, r;
+
+	make_window(&window, angle);
+	n = clip_grid(clip_transformed, &window, grid, p);
+	m = clip_grid(clip_transformed_scalar, &window, grid, q);
+	if (n != m) {
+		printf("angle %.2f grid %2d: %d vertices, scalar %d\n",
+		       angle, grid, n, m);
+		return 1;
+	}
+	for (i = 0; i < n * 2; i++) {
+		err = fabs(p[i] - q[i]) / (1.0 + fabs(q[i]));
+		if (err > errsup)
+			errsup = err;
+	}
+
+	/* Alternate between the two and keep the best of each, so that
+	 * neither gets all the frequency ramp-up or noise. */
+	t[0] = t[1] = HUGE_VAL;
+	for (r = 0; r < REPEATS; r++) {
+		reset_timer();
+		for (i = 0; i < iterations; i++)
+			clip_grid(clip_transformed, &window, grid, NULL);
+		t[0] = fmin(t[0], read_timer());
+		reset_timer();
+		for (i = 0; i < iterations; i++)
+			clip_grid(clip_transformed_scalar, &window, grid, NULL);
+		t[1] = fmin(t[1], read_timer());
+	}
+
+	printf("angle %.2f grid %2d: %4d vertices, "
+	       "%5.1f ns per clip (scalar %5.1f)\n", angle, grid, n,
+	       1e9 * t[0] / (iterations * grid * grid),
+	       1e9 * t[1] / (iterations * grid * grid));
+
+	if (errsup > 1e-5) {
+		printf("angle %.2f grid %2d: results differ, error %g\n",
+		       angle, grid, errsup);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static const float angles[] = { 0.0, 0.3, M_PI / 4, 2.0 };
+	static const int grids[] = { 1, 4, MAX_GRID };
+	int i, j, ret = 0;
+
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 4; j++)
+			ret |= run(angles[j], grids[i]);
+
+	return ret;
+}
@@ -22,6 +22,7 @@
 
 #include "config.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -128,7 +129,7 @@ struct weston_wm_window {
 	struct wl_listener surface_destroy_listener;
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
-	int properties_dirty;
+	uint32_t properties_dirty;	/* bit per wm_get_properties() entry */
 	int pid;
 	char *machine;
 	char *class;
@@ -346,6 +347,7 @@ dump_property(struct weston_wm *wm,
 	}
 }
 
+#ifdef WM_DEBUG
 static void
 read_and_dump_property(struct weston_wm *wm,
 		       xcb_window_t window, xcb_atom_t property)
@@ -361,6 +363,7 @@ read_and_dump_property(struct weston_wm *wm,
 
 	free(reply);
 }
+#endif
 
 /* We reuse some predefined, but otherwise useles atoms */
 #define TYPE_WM_PROTOCOLS	XCB_ATOM_CUT_BUFFER0
@@ -368,19 +371,21 @@ read_and_dump_property(struct weston_wm *wm,
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+struct wm_property {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	int offset;
+};
+
+#define WM_PROPERTY_COUNT	11
+#define WM_PROPERTIES_ALL	((1 << WM_PROPERTY_COUNT) - 1)
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+wm_get_properties(struct weston_wm *wm,
+		  struct wm_property props[WM_PROPERTY_COUNT])
 {
-	struct weston_wm *wm = window->wm;
-	struct weston_shell_interface *shell_interface =
-		&wm->server->compositor->shell_interface;
-
 #define F(field) offsetof(struct weston_wm_window, field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		int offset;
-	} props[] = {
+	const struct wm_property table[] = {
 		{ XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, F(class) },
 		{ XCB_ATOM_WM_NAME, XCB_ATOM_STRING, F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, F(transient_for) },
@@ -395,30 +400,86 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	assert(ARRAY_LENGTH(table) == WM_PROPERTY_COUNT);
+	memcpy(props, table, sizeof table);
+}
+
+/* Returns the properties_dirty bits to set when property changes.
+ * WM_NAME and _NET_WM_NAME both set the name, and _NET_WM_NAME, read after
+ * it, wins: a change to either re-reads both. */
+static uint32_t
+wm_property_dirty_bits(struct weston_wm *wm, xcb_atom_t property)
+{
+	struct wm_property props[WM_PROPERTY_COUNT];
+	uint32_t i, bits = 0;
+	int name;
+
+	name = property == XCB_ATOM_WM_NAME || property == wm->atom.net_wm_name;
+
+	wm_get_properties(wm, props);
+	for (i = 0; i < WM_PROPERTY_COUNT; i++)
+		if (props[i].atom == property ||
+		    (name && (props[i].atom == XCB_ATOM_WM_NAME ||
+			      props[i].atom == wm->atom.net_wm_name)))
+			bits |= 1 << i;
+
+	return bits;
+}
+
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_shell_interface *shell_interface =
+		&wm->server->compositor->shell_interface;
+	struct wm_property props[WM_PROPERTY_COUNT];
+	xcb_get_property_cookie_t cookie[WM_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t i, j, dirty;
+	int count = 0;
 
 	if (!window->properties_dirty)
 		return;
+	dirty = window->properties_dirty;
 	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
+	/* Only the properties that changed since the last read */
+	wm_get_properties(wm, props);
+	for (i = 0; i < WM_PROPERTY_COUNT; i++) {
+		if (!(dirty & (1 << i)))
+			continue;
+
 		cookie[i] = xcb_get_property(wm->conn,
 					     0, /* delete */
 					     window->id,
 					     props[i].atom,
 					     XCB_ATOM_ANY, 0, 2048);
+		count++;
+
+		switch (props[i].type) {
+		case TYPE_WM_PROTOCOLS:
+			window->delete_window = 0;
+			break;
+		case TYPE_WM_NORMAL_HINTS:
+			window->size_hints.flags = 0;
+			break;
+		case TYPE_MOTIF_WM_HINTS:
+			window->decorate = !window->override_redirect;
+			window->motif_hints.flags = 0;
+			break;
+		}
+	}
+
+	wm_log("XCB_GET_PROPERTY: window %d, %d of %d properties\n",
+	       window->id, count, WM_PROPERTY_COUNT);
 
-	window->decorate = !window->override_redirect;
-	window->size_hints.flags = 0;
-	window->motif_hints.flags = 0;
-	window->delete_window = 0;
+	for (i = 0; i < WM_PROPERTY_COUNT; i++)  {
+		if (!(dirty & (1 << i)))
+			continue;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
 		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
 		if (!reply)
 			/* Bad window, typically */
@@ -455,12 +516,10 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window)
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window)
 					window->delete_window = 1;
 			break;
-
-			break;
 		case TYPE_WM_NORMAL_HINTS:
 			memcpy(&window->size_hints,
 			       xcb_get_property_value(reply),
@@ -469,8 +528,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
 			break;
 		case TYPE_MOTIF_WM_HINTS:
@@ -487,6 +546,9 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		free(reply);
 	}
 
+	if (!(dirty & wm_property_dirty_bits(wm, XCB_ATOM_WM_NAME)))
+		return;
+
 	if (window->shsurf && window->name)
 		shell_interface->set_title(window->shsurf, window->name);
 	if (window->frame && window->name)
@@ -1058,14 +1120,17 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 	if (!window)
 		return;
 
-	window->properties_dirty = 1;
+	window->properties_dirty |=
+		wm_property_dirty_bits(wm, property_notify->atom);
 
+#ifdef WM_DEBUG
 	wm_log("XCB_PROPERTY_NOTIFY: window %d, ", property_notify->window);
 	if (property_notify->state == XCB_PROPERTY_DELETE)
 		wm_log("deleted\n");
 	else
 		read_and_dump_property(wm, property_notify->window,
 				       property_notify->atom);
+#endif
 
 	if (property_notify->atom == wm->atom.net_wm_name ||
 	    property_notify->atom == XCB_ATOM_WM_NAME)
@@ -1094,7 +1159,7 @@ weston_wm_window_create(struct weston_wm *wm,
 
 	window->wm = wm;
 	window->id = id;
-	window->properties_dirty = 1;
+	window->properties_dirty = WM_PROPERTIES_ALL;
 	window->override_redirect = override;
 	window->width = width;
 	window->height = height;